@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "my_secmalloc.private.h"
+
+/*
+ * Compares libc memset/memcpy with the non-temporal kernels of memops.c.
+ *
+ * Every iteration zeroes (or copies) a buffer of the measured size, then
+ * reads a small hot working set, as an allocator caller would after calloc
+ * or realloc. Cached stores are fast on their own but evict the working set;
+ * non-temporal stores leave it in cache. The benchmark prints the cost of
+ * one iteration for both variants and the size from which the kernels win
+ * at every larger size, which is what MSM_NT_ZERO_THRESHOLD and
+ * MSM_NT_COPY_THRESHOLD should be set to.
+ */
+
+#define MIN_SIZE (16 * 1024)
+#define MAX_SIZE (128 * 1024 * 1024)
+#define HOT_SIZE (256 * 1024)
+#define ROUNDS 5
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static unsigned long read_hot(const unsigned long *hot) {
+    unsigned long sum = 0;
+    for (size_t i = 0; i < HOT_SIZE / sizeof(*hot); i += 8) {
+        sum += hot[i];
+    }
+    return sum;
+}
+
+/**
+ * @brief Returns the best time, in microseconds, of one operation plus hot set read.
+ */
+static double best_us(int copy, int nt, char *dst, const char *src, size_t size, const unsigned long *hot) {
+    size_t repeat = (512 * 1024 * 1024) / size;
+    double best = 0;
+    volatile unsigned long sink = 0;
+
+    if (repeat == 0) {
+        repeat = 1;
+    }
+    if (repeat > 2000) {
+        repeat = 2000;
+    }
+    for (int round = 0; round < ROUNDS; round++) {
+        sink += read_hot(hot);
+        double start = now_s();
+        for (size_t i = 0; i < repeat; i++) {
+            if (copy) {
+                nt ? memops_copy_nt(dst, src, size) : (void)memcpy(dst, src, size);
+            } else {
+                nt ? memops_zero_nt(dst, size) : (void)memset(dst, 0, size);
+            }
+            sink += read_hot(hot);
+        }
+        double us = (now_s() - start) * 1e6 / (double)repeat;
+        if (round == 0 || us < best) {
+            best = us;
+        }
+    }
+    return best;
+}
+
+int main(void) {
+    char *src = mmap(NULL, MAX_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    char *dst = mmap(NULL, MAX_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    unsigned long *hot = mmap(NULL, HOT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    size_t crossover[2] = { 0, 0 };
+
+    if (src == MAP_FAILED || dst == MAP_FAILED || hot == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    memset(src, 'x', MAX_SIZE);
+    memset(hot, 1, HOT_SIZE);
+    printf("kernel: %s, current thresholds: zero %zu bytes, copy %zu bytes\n",
+           memops_kernel_name(), memops_zero_threshold, memops_copy_threshold);
+    printf("%12s %12s %12s %12s %12s   (us per operation + %d KiB hot set read)\n",
+           "size", "memset", "zero_nt", "memcpy", "copy_nt", HOT_SIZE / 1024);
+    for (size_t size = MIN_SIZE; size <= MAX_SIZE; size *= 2) {
+        double us[2][2];
+        for (int copy = 0; copy < 2; copy++) {
+            for (int nt = 0; nt < 2; nt++) {
+                us[copy][nt] = best_us(copy, nt, dst, src, size, hot);
+            }
+            if (us[copy][1] < us[copy][0]) {
+                if (crossover[copy] == 0) {
+                    crossover[copy] = size;
+                }
+            } else {
+                crossover[copy] = 0;
+            }
+        }
+        printf("%12zu %12.1f %12.1f %12.1f %12.1f\n", size, us[0][0], us[0][1], us[1][0], us[1][1]);
+    }
+    printf("zero crossover: %zu bytes\n", crossover[0]);
+    printf("copy crossover: %zu bytes\n", crossover[1]);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "my_secmalloc.private.h"
+
+/*
+ * Measures the latency of bounded-latency pool operations.
+ *
+ * A thread pinned to a pool replays the same pseudo-random sequence of
+ * allocations and frees several times and keeps, for every operation, its
+ * fastest run: preemption does not hit the same operation every time, so
+ * what is left is the cost of the pool itself. The benchmark prints the
+ * median, the 99th percentile and the worst of those costs.
+ */
+
+#define OPS 4096
+#define SLOTS 256
+#define RUNS 5
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int main(void) {
+    static uint64_t best[OPS];
+    struct msm_rt_pool *pool = msm_rt_pool_create(4 * 1024 * 1024);
+
+    if (pool == NULL) {
+        perror("msm_rt_pool_create");
+        return 1;
+    }
+    msm_rt_pin(pool);
+    for (int run = 0; run < RUNS; run++) {
+        void *slots[SLOTS] = { NULL };
+        unsigned int seed = 42;
+        for (int op = 0; op < OPS; op++) {
+            int slot = rand_r(&seed) % SLOTS;
+            size_t size = 1 + (size_t)(rand_r(&seed) % 8192);
+            uint64_t start = now_ns();
+            if (slots[slot] != NULL) {
+                my_free(slots[slot]);
+                slots[slot] = NULL;
+            } else {
+                slots[slot] = my_malloc(size);
+            }
+            uint64_t elapsed = now_ns() - start;
+            if (run == 0 || elapsed < best[op]) {
+                best[op] = elapsed;
+            }
+        }
+        for (int slot = 0; slot < SLOTS; slot++) {
+            my_free(slots[slot]);
+        }
+    }
+    msm_rt_pin(NULL);
+    msm_rt_pool_destroy(pool);
+
+    qsort(best, OPS, sizeof(uint64_t), compare_u64);
+    printf("rt pool operation: median %6llu ns, p99 %6llu ns, worst %6llu ns\n",
+           (unsigned long long)best[OPS / 2], (unsigned long long)best[OPS * 99 / 100], (unsigned long long)best[OPS - 1]);
+    return 0;
+}
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "my_secmalloc.private.h"
+
+/*
+ * Measures what the allocator costs a process that only lives a few
+ * milliseconds.
+ *
+ * Each sample forks a child that has never allocated, so the first my_malloc
+ * it makes runs the bootstrap; the child times that call and the next one
+ * and sends both back through a pipe. The parent never calls my_malloc.
+ * Given the path of a shared build of the library, the benchmark also
+ * spawns /bin/true with and without it in LD_PRELOAD and prints the mean
+ * wall time of both, which includes the loader and libc startup.
+ *
+ * usage: bench_startup [libmy_secmalloc_<profile>.so]
+ */
+
+#define SAMPLES 200
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Times the first and second my_malloc of fresh child processes.
+ */
+static int bench_first_malloc(void) {
+    double first[SAMPLES];
+    double second[SAMPLES];
+
+    for (int i = 0; i < SAMPLES; i++) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            perror("pipe");
+            return 1;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            double times[2];
+            double start = now_us();
+            void *a = my_malloc(32);
+            double middle = now_us();
+            void *b = my_malloc(32);
+            times[0] = middle - start;
+            times[1] = now_us() - middle;
+            my_free(a);
+            my_free(b);
+            _exit(write(fds[1], times, sizeof(times)) == sizeof(times) ? 0 : 1);
+        }
+        double times[2];
+        if (pid < 0 || read(fds[0], times, sizeof(times)) != sizeof(times)) {
+            perror("bench_startup child");
+            return 1;
+        }
+        waitpid(pid, NULL, 0);
+        close(fds[0]);
+        close(fds[1]);
+        first[i] = times[0];
+        second[i] = times[1];
+    }
+    qsort(first, SAMPLES, sizeof(double), compare_doubles);
+    qsort(second, SAMPLES, sizeof(double), compare_doubles);
+    printf("first my_malloc  : median %7.2f us, p90 %7.2f us\n", first[SAMPLES / 2], first[SAMPLES * 9 / 10]);
+    printf("second my_malloc : median %7.2f us, p90 %7.2f us\n", second[SAMPLES / 2], second[SAMPLES * 9 / 10]);
+    return 0;
+}
+
+/**
+ * @brief Returns the mean wall time, in microseconds, of running /bin/true.
+ */
+static double spawn_true_us(char **envp) {
+    char *argv[] = { "/bin/true", NULL };
+    double start = now_us();
+
+    for (int i = 0; i < SAMPLES; i++) {
+        pid_t pid;
+        if (posix_spawn(&pid, argv[0], NULL, NULL, argv, envp) != 0) {
+            return -1;
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return (now_us() - start) / SAMPLES;
+}
+
+int main(int argc, char **argv) {
+    if (bench_first_malloc() != 0) {
+        return 1;
+    }
+    if (argc > 1) {
+        char preload[4096];
+        char *envp[] = { preload, NULL };
+        char *plain[] = { NULL };
+        snprintf(preload, sizeof(preload), "LD_PRELOAD=%s", argv[1]);
+        double without = spawn_true_us(plain);
+        double with = spawn_true_us(envp);
+        if (without < 0 || with < 0) {
+            perror("posix_spawn");
+            return 1;
+        }
+        printf("/bin/true        : %7.1f us, %7.1f us with %s (+%.1f us)\n", without, with, argv[1], with - without);
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+#ifndef MSM_ALLOCATOR_HPP
+#define MSM_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include "my_secmalloc.h"
+
+/*
+ * STL allocators over the secmalloc heaps.
+ *
+ * msm::allocator places a container's storage in the lifetime heap chosen by
+ * its Hints (MSM_SHORT_LIVED, MSM_LONG_LIVED, MSM_HOT) and gives the size
+ * back on deallocation so the allocator can check it. msm::shm_allocator
+ * places it in a shared-memory or persistent heap. Both are header-only and
+ * only need the C API of the library.
+ */
+
+namespace msm {
+
+/**
+ * @brief Allocator placing elements in one of the lifetime heaps.
+ *
+ * @tparam T Element type.
+ * @tparam Hints MSM_* hints passed to msm_malloc_hint, 0 for the default heap.
+ */
+template <class T, unsigned Hints = 0>
+class allocator {
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    template <class U>
+    struct rebind {
+        using other = allocator<U, Hints>;
+    };
+
+    allocator() noexcept = default;
+
+    template <class U>
+    allocator(const allocator<U, Hints> &) noexcept {}
+
+    T *allocate(size_type count) {
+        if (count > static_cast<size_type>(-1) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void *ptr;
+        if (alignof(T) > 16) {
+            ptr = msm_aligned_alloc(alignof(T), count * sizeof(T), Hints);
+        } else {
+            ptr = msm_malloc_hint(count * sizeof(T), Hints);
+        }
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, size_type count) noexcept {
+        msm_free_sized(ptr, count * sizeof(T));
+    }
+};
+
+template <class T, class U, unsigned Hints>
+bool operator==(const allocator<T, Hints> &, const allocator<U, Hints> &) noexcept {
+    return true;
+}
+
+template <class T, class U, unsigned Hints>
+bool operator!=(const allocator<T, Hints> &, const allocator<U, Hints> &) noexcept {
+    return false;
+}
+
+/**
+ * @brief Allocator placing elements in a shared-memory or persistent heap.
+ *
+ * @tparam T Element type, aligned on 16 bytes at most.
+ *
+ * Containers using it only hold plain pointers, so they are usable from the
+ * process that built them; for data shared between processes, store offsets
+ * obtained from msm_shm_offset.
+ */
+template <class T>
+class shm_allocator {
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    static_assert(alignof(T) <= 16, "shared heaps align blocks on 16 bytes");
+
+    template <class U>
+    struct rebind {
+        using other = shm_allocator<U>;
+    };
+
+    explicit shm_allocator(msm_shm_heap *heap) noexcept : heap_(heap) {}
+
+    template <class U>
+    shm_allocator(const shm_allocator<U> &other) noexcept : heap_(other.heap()) {}
+
+    msm_shm_heap *heap() const noexcept {
+        return heap_;
+    }
+
+    T *allocate(size_type count) {
+        if (count > static_cast<size_type>(-1) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void *ptr = msm_shm_malloc(heap_, count * sizeof(T));
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, size_type) noexcept {
+        msm_shm_free(heap_, ptr);
+    }
+
+private:
+    msm_shm_heap *heap_;
+};
+
+template <class T, class U>
+bool operator==(const shm_allocator<T> &a, const shm_allocator<U> &b) noexcept {
+    return a.heap() == b.heap();
+}
+
+template <class T, class U>
+bool operator!=(const shm_allocator<T> &a, const shm_allocator<U> &b) noexcept {
+    return a.heap() != b.heap();
+}
+
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef _SECMALLOC_CONFIG_H
+#define _SECMALLOC_CONFIG_H
+
+/**
+ * @brief Build profile selection.
+ *
+ * The Makefile defines exactly one of MSM_PROFILE_FAST, MSM_PROFILE_BALANCED
+ * or MSM_PROFILE_HARDENED (`make PROFILE=fast|balanced|hardened`). When none
+ * is given the hardened profile is used, which matches the historical
+ * behaviour of the library.
+ *
+ * Each profile only sets the feature macros below; any of them can still be
+ * forced from the command line (e.g. `-DMSM_LOGGING=1` on a fast build).
+ * A feature set to 0 is not compiled at all, it is not a runtime switch.
+ *
+ *   feature           fast   balanced   hardened
+ *   MSM_CHECKS          0        1          1
+ *   MSM_LOGGING         0        0          1
+ *   MSM_HISTOGRAMS      0        1          1
+ *   MSM_RANDOM_SLOTS    0        1          1
+ *   MSM_SCRUBBER        0        1          1
+ */
+#if defined(MSM_PROFILE_FAST)
+# define MSM_PROFILE_NAME "fast"
+# define MSM_PROFILE_CHECKS 0
+# define MSM_PROFILE_LOGGING 0
+# define MSM_PROFILE_HISTOGRAMS 0
+# define MSM_PROFILE_RANDOM_SLOTS 0
+# define MSM_PROFILE_SCRUBBER 0
+#elif defined(MSM_PROFILE_BALANCED)
+# define MSM_PROFILE_NAME "balanced"
+# define MSM_PROFILE_CHECKS 1
+# define MSM_PROFILE_LOGGING 0
+# define MSM_PROFILE_HISTOGRAMS 1
+# define MSM_PROFILE_RANDOM_SLOTS 1
+# define MSM_PROFILE_SCRUBBER 1
+#else
+# define MSM_PROFILE_NAME "hardened"
+# define MSM_PROFILE_CHECKS 1
+# define MSM_PROFILE_LOGGING 1
+# define MSM_PROFILE_HISTOGRAMS 1
+# define MSM_PROFILE_RANDOM_SLOTS 1
+# define MSM_PROFILE_SCRUBBER 1
+#endif
+
+/**
+ * @brief Canary, double free and invalid size checks in my_free and my_realloc.
+ */
+#ifndef MSM_CHECKS
+# define MSM_CHECKS MSM_PROFILE_CHECKS
+#endif
+
+/**
+ * @brief Execution report (MSM_OUTPUT) support.
+ */
+#ifndef MSM_LOGGING
+# define MSM_LOGGING MSM_PROFILE_LOGGING
+#endif
+
+/**
+ * @brief Per-thread latency histograms of the allocation entry points.
+ *
+ * Compiled in, they stay disabled until MSM_HISTOGRAMS is set in the
+ * environment or msm_histograms_enable() is called.
+ */
+#ifndef MSM_HISTOGRAMS
+# define MSM_HISTOGRAMS MSM_PROFILE_HISTOGRAMS
+#endif
+
+/**
+ * @brief Random slot selection inside size-class slabs.
+ *
+ * When 0, slabs hand out their lowest free slot first.
+ */
+#ifndef MSM_RANDOM_SLOTS
+# define MSM_RANDOM_SLOTS MSM_PROFILE_RANDOM_SLOTS
+#endif
+
+/**
+ * @brief Background thread checking chunk headers and free-list links.
+ *
+ * Compiled in, it only runs once MSM_SCRUB is set in the environment or
+ * msm_scrubber_start() is called.
+ */
+#ifndef MSM_SCRUBBER
+# define MSM_SCRUBBER MSM_PROFILE_SCRUBBER
+#endif
+
+#endif
@@ -2,10 +2,120 @@
 #define _SECMALLOC_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 void    *malloc(size_t size);
 void    free(void *ptr);
 void    *calloc(size_t nmemb, size_t size);
 void    *realloc(void *ptr, size_t size);
 
+/* Extended API */
+size_t  msm_purge(void);
+void    msm_set_fork_purge(int enabled);
+int     msm_set_limits(size_t soft_limit, size_t hard_limit);
+void    msm_set_soft_limit_callback(void (*callback)(size_t mapped, void *arg), void *arg);
+size_t  msm_mapped_bytes(void);
+size_t  msm_malloc_usable_size(void *ptr);
+
+struct msm_rt_pool;
+struct msm_rt_pool *msm_rt_pool_create(size_t size);
+void    msm_rt_pool_destroy(struct msm_rt_pool *pool);
+void    msm_rt_pin(struct msm_rt_pool *pool);
+
+/* Allocation hints: heaps segregated by expected lifetime and temperature */
+#define MSM_SHORT_LIVED 0x1
+#define MSM_LONG_LIVED  0x2
+#define MSM_HOT         0x4
+
+enum msm_heap_id {
+    MSM_HEAP_DEFAULT,       /* my_malloc, and hints that contradict each other */
+    MSM_HEAP_SHORT_LIVED,
+    MSM_HEAP_LONG_LIVED,
+    MSM_HEAP_HOT,           /* MSM_HOT, whatever the lifetime */
+    MSM_HEAP_COUNT
+};
+
+struct msm_heap_stats {
+    size_t   pages;         /* chunk pages mapped now */
+    size_t   empty_pages;   /* of which hold no live block and could be purged */
+    size_t   busy_bytes;    /* bytes of live blocks, headers excluded */
+    size_t   free_bytes;    /* bytes of free chunks, headers excluded */
+    uint64_t pages_mapped;  /* pages mapped since startup */
+    uint64_t pages_purged;  /* pages given back by msm_purge since startup */
+};
+
+void    *msm_malloc_hint(size_t size, unsigned hints);
+void    *msm_aligned_alloc(size_t alignment, size_t size, unsigned hints);
+void    msm_free_sized(void *ptr, size_t size);
+int     msm_heap_stats(struct msm_heap_stats out[MSM_HEAP_COUNT]);
+
+/* Shared-memory and persistent heaps */
+#define MSM_SHM_ROOTS 32
+#define MSM_SHM_ROOT_NAME 24
+#define MSM_PERSIST_DEFAULT_BASE ((void *)0x600000000000UL)
+
+struct msm_shm_heap;
+struct msm_shm_heap *msm_shm_create(int fd, size_t size);
+struct msm_shm_heap *msm_shm_attach(int fd);
+void    msm_shm_detach(struct msm_shm_heap *heap);
+void    *msm_shm_malloc(struct msm_shm_heap *heap, size_t size);
+void    msm_shm_free(struct msm_shm_heap *heap, void *ptr);
+uint64_t msm_shm_offset(struct msm_shm_heap *heap, void *ptr);
+void    *msm_shm_pointer(struct msm_shm_heap *heap, uint64_t offset);
+int     msm_shm_set_root(struct msm_shm_heap *heap, const char *name, void *ptr);
+void    *msm_shm_get_root(struct msm_shm_heap *heap, const char *name);
+struct msm_shm_heap *msm_persist_open(const char *path, size_t size, void *base);
+int     msm_persist_sync(struct msm_shm_heap *heap);
+void    msm_persist_close(struct msm_shm_heap *heap);
+
+/* Latency histograms (balanced and hardened profiles) */
+enum msm_hist_op {
+    MSM_OP_MALLOC,
+    MSM_OP_FREE,
+    MSM_OP_CALLOC,
+    MSM_OP_REALLOC,
+    MSM_OP_COUNT
+};
+
+enum msm_hist_path {
+    MSM_PATH_CACHE,     /* served by the first candidate, a pool or in place */
+    MSM_PATH_SEARCH,    /* free list walked past non-fitting chunks */
+    MSM_PATH_MAP,       /* new page or large mapping */
+    MSM_PATH_COUNT
+};
+
+#define MSM_HIST_SIZE_CLASSES 16
+#define MSM_HIST_BUCKETS 128
+
+struct msm_histograms {
+    uint64_t count[MSM_OP_COUNT][MSM_PATH_COUNT][MSM_HIST_SIZE_CLASSES][MSM_HIST_BUCKETS];
+};
+
+int     msm_histograms_enable(int enabled);
+int     msm_histograms_collect(struct msm_histograms *out);
+void    msm_histograms_dump(int fd);
+uint64_t msm_histogram_bucket_floor(int bucket);
+size_t  msm_histogram_size_class_limit(int size_class);
+
+/* Background heap scrubber (balanced and hardened profiles) */
+struct msm_scrub_stats {
+    uint64_t passes;        /* complete walks of the page map */
+    uint64_t pages;         /* pages checked */
+    uint64_t errors;        /* corrupted headers and broken links found */
+    void     *last_error;   /* address of the last one */
+};
+
+int     msm_scrubber_start(unsigned interval_ms, unsigned budget_us);
+void    msm_scrubber_stop(void);
+int     msm_scrub(unsigned budget_us);
+int     msm_scrubber_stats(struct msm_scrub_stats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -2,7 +2,15 @@
 #define _SECMALLOC_PRIVATE_H
 
 #include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <string.h>
 #include "my_secmalloc.h"
+#include "my_secmalloc.config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 
 /**
@@ -25,6 +33,130 @@
  */
 #define METADATA_CHUNKS_PER_PAGE (PAGE_SIZE / CHUNK_SIZE)
 
+/**
+ * @brief Maximum number of bounded-latency pools alive at the same time.
+ */
+#define MSM_RT_MAX_POOLS 8
+
+/**
+ * @brief Page map geometry: 47-bit user addresses, a root of 2^17 leaves of 2^18 pages.
+ */
+#define PAGEMAP_PAGE_SHIFT 12
+#define PAGEMAP_LEAF_BITS 18
+#define PAGEMAP_ROOT_BITS (47 - PAGEMAP_PAGE_SHIFT - PAGEMAP_LEAF_BITS)
+#define PAGEMAP_ROOT_BYTES (((size_t)1 << PAGEMAP_ROOT_BITS) * sizeof(void *))
+/**
+ * @brief Chunk pages mapped by heap_bootstrap, ahead of the page map root.
+ */
+#define BOOTSTRAP_PAGES 2
+
+/**
+ * @brief Largest request served from size-class slabs.
+ */
+#define SLAB_MAX_SIZE 256
+
+/**
+ * @brief Requests above this size do not fit in a chunk page and get their own mapping.
+ */
+#define LARGE_THRESHOLD (PAGE_SIZE - CHUNK_SIZE)
+
+/**
+ * @brief Default sizes from which memops_zero and memops_copy use non-temporal stores.
+ *
+ * Crossovers measured by bench/bench_memops.c on the build machine: libc's
+ * memset stays competitive far longer than its memcpy.
+ */
+#define MSM_NT_ZERO_THRESHOLD_DEFAULT (64 * 1024 * 1024)
+#define MSM_NT_COPY_THRESHOLD_DEFAULT (2 * 1024 * 1024)
+
+/**
+ * @brief Global heap lock.
+ *
+ * Recursive because my_realloc and my_calloc call back into my_malloc and
+ * my_free while holding it.
+ */
+extern pthread_mutex_t heap_lock;
+#define HEAP_LOCK() pthread_mutex_lock(&heap_lock)
+#define HEAP_UNLOCK() pthread_mutex_unlock(&heap_lock)
+
+#if MSM_HISTOGRAMS
+extern int hist_enabled;
+extern __thread int hist_path;
+extern __thread size_t hist_size;
+extern __thread int hist_depth;
+void hist_record(enum msm_hist_op op, size_t size, uint64_t start);
+void histograms_init(void);
+void histograms_atfork_prepare(void);
+void histograms_atfork_parent(void);
+void histograms_atfork_child(void);
+
+/**
+ * @brief Reads the time stamp counter, or a nanosecond clock elsewhere.
+ */
+static inline uint64_t hist_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Starts measuring a caller-visible operation.
+ *
+ * Calls nested inside it (my_malloc from my_realloc, ...) are part of its
+ * latency and are not recorded on their own.
+ */
+static inline uint64_t hist_begin(void) {
+    hist_depth = 1;
+    hist_path = MSM_PATH_CACHE;
+    return hist_now();
+}
+
+/**
+ * @brief Records the path taken by the current operation, keeping the slowest one seen.
+ */
+#define HIST_PATH(path) (hist_path = (path) > hist_path ? (path) : hist_path)
+/**
+ * @brief Records the size handled by the current operation when the caller does not know it.
+ */
+#define HIST_SIZE(size) (hist_size = (size))
+#else
+#define HIST_PATH(path) ((void)0)
+#define HIST_SIZE(size) ((void)0)
+#endif
+
+extern size_t memops_zero_threshold;
+extern size_t memops_copy_threshold;
+void memops_init(void);
+void memops_zero_nt(void *dst, size_t n);
+void memops_copy_nt(void *dst, const void *src, size_t n);
+const char *memops_kernel_name(void);
+
+/**
+ * @brief Zeroes a buffer, bypassing the caches when it is large.
+ */
+static inline void memops_zero(void *dst, size_t n) {
+    if (n >= memops_zero_threshold) {
+        memops_zero_nt(dst, n);
+    } else {
+        memset(dst, 0, n);
+    }
+}
+
+/**
+ * @brief Copies a buffer, bypassing the caches when it is large.
+ */
+static inline void memops_copy(void *dst, const void *src, size_t n) {
+    if (n >= memops_copy_threshold) {
+        memops_copy_nt(dst, src, n);
+    } else {
+        memcpy(dst, src, n);
+    }
+}
+
 /**
  * @brief Enumeration for chunk types.
  */
@@ -35,8 +167,11 @@ enum chunk_type {
 
 /**
  * @brief Structure representing a memory chunk.
+ *
+ * Aligned so that CHUNK_SIZE is a multiple of 16, like every chunk size,
+ * which keeps the data following each header 16-byte aligned.
  */
-struct chunk {
+struct __attribute__((aligned(16))) chunk {
     size_t size;            /**< Size of the chunk's data area. */
     uint32_t canary_start;  /**< Canary value at the start of the chunk. */
     uint32_t canary_end;    /**< Canary value at the end of the chunk. */
@@ -44,16 +179,178 @@ struct chunk {
     struct chunk *prev;     /**< Pointer to the previous chunk in the linked list. */
     enum chunk_type flags;  /**< Flags indicating the status of the chunk (FREE or BUSY). */
 };
-void initialize_metadata();
+/**
+ * @brief Free lists of the chunk heaps, indexed by enum msm_heap_id.
+ *
+ * The page map owner of a chunk page is the heap the page belongs to, so a
+ * free chunk always goes back to the list it was taken from.
+ */
+extern struct chunk *free_lists[MSM_HEAP_COUNT];
+extern uint64_t heap_pages_mapped[MSM_HEAP_COUNT];
+extern uint64_t heap_pages_purged[MSM_HEAP_COUNT];
+void *heap_malloc(size_t size, int heap);
+void *heap_memalign(size_t alignment, size_t size, int heap);
+int heap_for_hints(unsigned hints);
+int chunk_page_is_free(char *page);
+void unlink_chunk(struct chunk *chunk);
+size_t purge_free_pages(void);
+void register_fork_handlers(void);
+void limits_init(void);
+int limit_reserve(size_t bytes);
+void limit_release(size_t bytes);
+void limits_atfork_prepare(void);
+void limits_atfork_child(void);
+extern int rt_pool_count;
+extern __thread struct msm_rt_pool *rt_pinned_pool;
+struct msm_rt_pool *rt_pool_of(void *ptr);
+void *rt_malloc(struct msm_rt_pool *pool, size_t size);
+void rt_free(struct msm_rt_pool *pool, void *ptr);
+size_t rt_usable_size(void *ptr);
+void rt_atfork_prepare(void);
+void rt_atfork_parent(void);
+void rt_atfork_child(void);
+void *slab_malloc(size_t size);
+void slab_free(void *ptr);
+size_t slab_class_size(int size_class);
+void slab_atfork_child(void);
+int slab_check_invariants(size_t *pages);
+void *large_malloc(size_t size, size_t alignment);
+void large_free(void *ptr);
+void *large_realloc(void *ptr, size_t size);
+int heap_check_invariants(void);
+#if MSM_SCRUBBER
+void scrubber_init(void);
+void scrubber_atfork_child(void);
+#endif
+
+/**
+ * @brief Allocator owning a page, as recorded in the page map.
+ */
+enum page_kind {
+    PAGE_NONE = 0,      /**< Not owned: never mapped by the allocator, or unmapped since. */
+    PAGE_CHUNK = 1,     /**< Page of the chunk heap. */
+    PAGE_SLAB = 2,      /**< Size-class slab. */
+    PAGE_RT_POOL = 3,   /**< Part of a bounded-latency pool. */
+    PAGE_LARGE = 4      /**< Part of a single large allocation. */
+};
+
+/**
+ * @brief Page map entry.
+ */
+struct page_info {
+    uint8_t kind;       /**< enum page_kind. */
+    uint8_t size_class; /**< Size class of a slab page, LARGE_HEAD on the page holding a large block's data start. */
+    uint16_t owner;     /**< Owning pool or heap; offset of the block in a LARGE_HEAD page. */
+};
+
+/**
+ * @brief page_info.size_class of the page where the data of a large allocation starts.
+ */
+#define LARGE_HEAD 1
+
+extern struct page_info **pagemap_root;
+void pagemap_for_each(void (*visit)(void *page, struct page_info info, void *arg), void *arg);
+uintptr_t pagemap_walk(uintptr_t from, size_t pages, size_t entries,
+                       void (*visit)(void *page, struct page_info info, void *arg), void *arg);
+int pagemap_set(void *start, size_t length, enum page_kind kind, int size_class, int owner);
+void pagemap_clear(void *start, size_t length);
+int pagemap_adopt_root(void *root);
+
+/**
+ * @brief Returns the page map entry of the page holding an address, in constant time.
+ */
+static inline struct page_info pagemap_lookup(const void *ptr) {
+    struct page_info none = { PAGE_NONE, 0, 0 };
+    uintptr_t page = (uintptr_t)ptr >> PAGEMAP_PAGE_SHIFT;
+    struct page_info **root = __atomic_load_n(&pagemap_root, __ATOMIC_ACQUIRE);
+
+    if (root == NULL || (page >> (PAGEMAP_ROOT_BITS + PAGEMAP_LEAF_BITS)) != 0) {
+        return none;
+    }
+    struct page_info *leaf = __atomic_load_n(&root[page >> PAGEMAP_LEAF_BITS], __ATOMIC_ACQUIRE);
+    if (leaf == NULL) {
+        return none;
+    }
+    return leaf[page & (((uintptr_t)1 << PAGEMAP_LEAF_BITS) - 1)];
+}
+
+/**
+ * @brief Tells whether a pointer is the start of a large allocation, given its page's entry.
+ */
+static inline int large_is_block(const void *ptr, struct page_info page) {
+    return page.kind == PAGE_LARGE && page.size_class == LARGE_HEAD
+        && ((uintptr_t)ptr & (PAGE_SIZE - 1)) == page.owner;
+}
+
+struct chunk *check_chunk_page(char *page, int heap, size_t *free_chunks);
+struct chunk *check_large_head(char *page, int owner);
+struct chunk *slab_check_page(char *page, int size_class);
+
+/**
+ * @brief Header of a chunk in a shared heap. Links are offsets from the start of the heap.
+ */
+struct shm_chunk {
+    uint64_t size;          /**< Size of the chunk's data area. */
+    uint64_t prev_phys;     /**< Offset of the physically preceding chunk, 0 for the first one. */
+    uint32_t canary_start;  /**< Canary value at the start of the chunk. */
+    uint32_t canary_end;    /**< Canary value at the end of the chunk. */
+    uint64_t next;          /**< Offset of the next free chunk, 0 for none. */
+    uint64_t prev;          /**< Offset of the previous free chunk, 0 for none. */
+    uint32_t flags;         /**< FREE or BUSY. */
+    uint32_t reserved;      /**< Keeps the header a multiple of 16 bytes. */
+};
+
+/**
+ * @brief Named object of a shared heap.
+ */
+struct shm_root {
+    char name[MSM_SHM_ROOT_NAME]; /**< NUL-terminated name. */
+    uint64_t offset;              /**< Offset of the object, 0 when the slot is unused. */
+};
+
+/**
+ * @brief Header at the start of a shared heap, followed by its chunks.
+ */
+struct msm_shm_heap {
+    uint64_t magic;         /**< Set last when the heap is formatted. */
+    uint32_t version;       /**< Layout version. */
+    uint32_t broken;        /**< Set when recovery met a corrupted chunk. */
+    uint64_t size;          /**< Size of the whole mapping. */
+    uint64_t free_list;     /**< Offset of the first free chunk, 0 for none. */
+    uint64_t base;          /**< Address the heap was formatted at, reused by persistent heaps. */
+    uint32_t dirty;         /**< Set while a persistent heap is open, cleared by a clean close. */
+    uint32_t recoveries;    /**< Number of recovery passes run on the heap. */
+    uint64_t reserved;      /**< Padding. */
+    pthread_mutex_t lock;   /**< Process-shared, robust. */
+    struct shm_root roots[MSM_SHM_ROOTS]; /**< Named objects. */
+};
+int shm_recover(struct msm_shm_heap *heap);
+void shm_init_lock(struct msm_shm_heap *heap);
+void shm_format(struct msm_shm_heap *heap, size_t size);
+int shm_header_valid(struct msm_shm_heap *heap, size_t size);
+size_t shm_min_size(void);
+extern int heap_ready;
+void heap_bootstrap(void);
+void push_free_page(struct chunk *page, int heap);
 void check_free_leak();
-void initialize_data();
-struct chunk *find_free_chunk(size_t size);
-struct chunk *allocate_page();
+struct chunk *find_free_chunk(size_t size, int heap);
+struct chunk *allocate_page(int heap);
+#if MSM_LOGGING
 void log_execution_report(int color_value, const char *func_type, size_t size, void *addr);
+#else
+/**
+ * @brief Logging is compiled out: the call and its arguments disappear.
+ */
+#define log_execution_report(color_value, func_type, size, addr) ((void)0)
+#endif
 void debug_print(int color_value, const char *format, ...);
 void *my_malloc(size_t size);
 void my_free(void *ptr);
 void *my_calloc(size_t nmemb, size_t size);
 void *my_realloc(void *ptr, size_t size);
-void init_execution_report();
+void *my_aligned_alloc(size_t alignment, size_t size);
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -10,7 +10,30 @@
 FILE *execution_report = NULL;
 struct chunk *metadata_pages = NULL;
 struct chunk *data_pages = NULL;
-struct chunk *free_list = NULL; 
+struct chunk *free_lists[MSM_HEAP_COUNT];
+pthread_mutex_t heap_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/**
+ * @brief Removes a chunk from the free list.
+ *
+ * @param chunk Pointer to the chunk to unlink (input).
+ *
+ * The caller must hold the heap lock. The chunk's own links are cleared so a
+ * stale chunk can never be walked back into the list. The page map tells
+ * which heap's list heads the chunk.
+ */
+void unlink_chunk(struct chunk *chunk) {
+    if (chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        free_lists[pagemap_lookup(chunk).owner] = chunk->next;
+    }
+    if (chunk->next) {
+        chunk->next->prev = chunk->prev;
+    }
+    chunk->next = NULL;
+    chunk->prev = NULL;
+}
 
 /**
  * @brief Splits a chunk if it's larger than the requested size.
@@ -43,57 +66,187 @@ struct chunk *free_list = NULL;
 }
 
 /**
- * @brief Allocates memory of the specified size.
+ * @brief Finds a free chunk of a heap, mapping a new page if none is large enough.
+ *
+ * @param size Size the chunk must hold, at most LARGE_THRESHOLD (input).
+ * @param heap Heap to take the chunk from (input).
+ * @return The chunk, still on the free list, or NULL if no page could be mapped.
+ *
+ * The caller must hold the heap lock.
+ */
+static struct chunk *take_free_chunk(size_t size, int heap) {
+    struct chunk *free_chunk = find_free_chunk(size, heap);
+    if (free_chunk == NULL) {
+        HIST_PATH(MSM_PATH_MAP);
+        struct chunk *new_data_page = allocate_page(heap);
+        if (new_data_page == NULL) {
+            log_execution_report(1, "Failed to allocated memory", 0,new_data_page);
+            return NULL;
+        }
+        push_free_page(new_data_page, heap);
+        if (heap == MSM_HEAP_DEFAULT) {
+            data_pages = new_data_page;
+        }
+        free_chunk = new_data_page;
+    }
+    return free_chunk;
+}
+
+/**
+ * @brief Allocates memory of the specified size from one of the chunk heaps.
  *
  * @param size Size of the memory to allocate (input).
+ * @param heap Heap serving the request, an enum msm_heap_id (input).
  * @return Pointer to the allocated memory block, or NULL if allocation fails.
  *
  * This function allocates memory of the specified size. It first checks for a free chunk
  * of sufficient size. If no suitable chunk is found, it allocates a new page of memory
  * and initializes it as a free chunk. If allocation fails, it returns NULL.
+ * Threads pinned to a bounded-latency pool are served from that pool only,
+ * requests up to SLAB_MAX_SIZE go to the size-class slabs first, and requests
+ * above LARGE_THRESHOLD get a mapping of their own.
+ * Only the default heap uses the slabs: the other heaps exist to keep their
+ * blocks out of pages shared with blocks of another lifetime, so even their
+ * small requests get chunks from pages of their own.
  */
- void *my_malloc(size_t size) {
+void *heap_malloc(size_t size, int heap) {
     log_execution_report(3, "my_malloc called", size, NULL);
     if (size == 0) {
         return NULL;
     }
-    if (metadata_pages == NULL) {
-        initialize_metadata();
+    if (rt_pinned_pool != NULL) {
+        HIST_PATH(MSM_PATH_CACHE);
+        return rt_malloc(rt_pinned_pool, size);
     }
-    if (data_pages == NULL) {
-        initialize_data();
+    if (__builtin_expect(!__atomic_load_n(&heap_ready, __ATOMIC_ACQUIRE), 0)) {
+        heap_bootstrap();
     }
-    struct chunk *free_chunk = find_free_chunk(size);
-    if (free_chunk == NULL) {
-        struct chunk *new_data_page = allocate_page();
-        if (new_data_page == NULL) {
-            log_execution_report(1, "Failed to allocated memory", 0,new_data_page);
-            return NULL;
+    HEAP_LOCK();
+    if (size <= SLAB_MAX_SIZE && heap == MSM_HEAP_DEFAULT) {
+        void *slot = slab_malloc(size);
+        if (slot != NULL) {
+            HIST_PATH(MSM_PATH_CACHE);
+            HEAP_UNLOCK();
+            return slot;
         }
-        new_data_page->size = PAGE_SIZE - CHUNK_SIZE;
-        new_data_page->flags = FREE;
-        new_data_page->canary_start = CANARY_VALUE;
-        new_data_page->canary_end = CANARY_VALUE;
-        new_data_page->next = data_pages;
-        data_pages = new_data_page;
-        free_chunk = new_data_page;
     }
-    split_chunk(free_chunk, size);
-    free_chunk->flags = BUSY;
-    if (free_chunk->prev) {
-        free_chunk->prev->next = free_chunk->next;
-    } else {
-        free_list = free_chunk->next;
+    if (size > LARGE_THRESHOLD) {
+        HIST_PATH(MSM_PATH_MAP);
+        void *large = large_malloc(size, 16);
+        HEAP_UNLOCK();
+        return large;
     }
-    if (free_chunk->next) {
-        free_chunk->next->prev = free_chunk->prev;
+    /* Keep every header, and so every returned pointer, 16-byte aligned. */
+    size = (size + 15) & ~(size_t)15;
+    struct chunk *free_chunk = take_free_chunk(size, heap);
+    if (free_chunk == NULL) {
+        HEAP_UNLOCK();
+        return NULL;
     }
+    split_chunk(free_chunk, size);
+    free_chunk->flags = BUSY;
+    unlink_chunk(free_chunk);
     void *allocated_memory = (void *)(free_chunk + 1);
     log_execution_report(2, "my_malloc",free_chunk->size , allocated_memory);
+    HEAP_UNLOCK();
 
     return allocated_memory;
 }
 
+/**
+ * @brief Allocates memory aligned beyond 16 bytes from one of the chunk heaps.
+ *
+ * @param alignment Alignment of the block, a power of two (input).
+ * @param size Size of the memory to allocate (input).
+ * @param heap Heap serving the request, an enum msm_heap_id (input).
+ * @return Pointer to the allocated memory block, or NULL if allocation fails.
+ *
+ * A free chunk with room for the alignment is taken, and the bytes before the
+ * aligned address are split off as a free chunk of their own, so the block
+ * is an ordinary chunk for my_free and my_realloc. Requests that would not
+ * fit in a page with that room go to large_malloc. Slab slots are only
+ * 16-byte aligned and are not used. Threads pinned to a bounded-latency pool
+ * get NULL with errno set to ENOMEM, as the pools do not align beyond 16.
+ */
+void *heap_memalign(size_t alignment, size_t size, int heap) {
+    if (alignment <= 16) {
+        return heap_malloc(size, heap);
+    }
+    log_execution_report(3, "my_aligned_alloc called", size, NULL);
+    if (size == 0) {
+        return NULL;
+    }
+    if (rt_pinned_pool != NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (__builtin_expect(!__atomic_load_n(&heap_ready, __ATOMIC_ACQUIRE), 0)) {
+        heap_bootstrap();
+    }
+    HEAP_LOCK();
+    /* Room for a leading free chunk of at least 16 bytes, then the aligned block. */
+    if (alignment >= PAGE_SIZE || size > LARGE_THRESHOLD - alignment - CHUNK_SIZE - 16) {
+        HIST_PATH(MSM_PATH_MAP);
+        void *large = large_malloc(size, alignment);
+        HEAP_UNLOCK();
+        return large;
+    }
+    size = (size + 15) & ~(size_t)15;
+    struct chunk *free_chunk = take_free_chunk(size + alignment + CHUNK_SIZE + 16, heap);
+    if (free_chunk == NULL) {
+        HEAP_UNLOCK();
+        return NULL;
+    }
+    uintptr_t data = (uintptr_t)(free_chunk + 1);
+    size_t gap = ((data + alignment - 1) & ~(uintptr_t)(alignment - 1)) - data;
+    if (gap != 0 && gap < CHUNK_SIZE + 16) {
+        /* Whole multiples of the alignment, until the leading chunk holds 16 bytes. */
+        gap += (CHUNK_SIZE + 16 - gap + alignment - 1) & ~(alignment - 1);
+    }
+    if (gap != 0) {
+        struct chunk *aligned = (struct chunk *)(data + gap) - 1;
+        aligned->size = free_chunk->size - gap;
+        aligned->flags = FREE;
+        aligned->canary_start = CANARY_VALUE;
+        aligned->canary_end = CANARY_VALUE;
+        aligned->next = free_chunk->next;
+        aligned->prev = free_chunk;
+        if (free_chunk->next) {
+            free_chunk->next->prev = aligned;
+        }
+        free_chunk->next = aligned;
+        free_chunk->size = gap - CHUNK_SIZE;
+        free_chunk = aligned;
+    }
+    split_chunk(free_chunk, size);
+    free_chunk->flags = BUSY;
+    unlink_chunk(free_chunk);
+    log_execution_report(2, "my_aligned_alloc", free_chunk->size, free_chunk + 1);
+    HEAP_UNLOCK();
+    return free_chunk + 1;
+}
+
+/**
+ * @brief Allocates memory of the specified size.
+ *
+ * @param size Size of the memory to allocate (input).
+ * @return Pointer to the allocated memory block, or NULL if allocation fails.
+ *
+ * Entry point around heap_malloc that records the call's latency when the
+ * histograms are enabled.
+ */
+void *my_malloc(size_t size) {
+#if MSM_HISTOGRAMS
+    if (hist_enabled && !hist_depth) {
+        uint64_t start = hist_begin();
+        void *ptr = heap_malloc(size, MSM_HEAP_DEFAULT);
+        hist_record(MSM_OP_MALLOC, size, start);
+        return ptr;
+    }
+#endif
+    return heap_malloc(size, MSM_HEAP_DEFAULT);
+}
+
 #ifdef DYNAMIC
 
 /**
@@ -151,4 +304,63 @@ void    *realloc(void *ptr, size_t size)
 
 }
 
+/**
+ * @brief Overrides the standard library function malloc_usable_size with msm_malloc_usable_size.
+ *
+ * @param ptr Pointer to an allocated memory block (input).
+ * @return Number of usable bytes in the block, 0 if the allocator does not own it.
+ */
+size_t  malloc_usable_size(void *ptr)
+{
+    return msm_malloc_usable_size(ptr);
+}
+
+/**
+ * @brief Overrides the standard library function aligned_alloc with my_aligned_alloc.
+ *
+ * @param alignment Alignment of the block, a power of two (input).
+ * @param size Size of the memory to allocate (input).
+ * @return Pointer to the allocated memory block, or NULL if allocation fails.
+ *
+ * Without it, blocks aligned by the libc would reach my_free, which does not
+ * own them.
+ */
+void    *aligned_alloc(size_t alignment, size_t size)
+{
+    return my_aligned_alloc(alignment, size);
+}
+
+/**
+ * @brief Overrides the standard library function memalign with my_aligned_alloc.
+ *
+ * @param alignment Alignment of the block, a power of two (input).
+ * @param size Size of the memory to allocate (input).
+ * @return Pointer to the allocated memory block, or NULL if allocation fails.
+ */
+void    *memalign(size_t alignment, size_t size)
+{
+    return my_aligned_alloc(alignment, size);
+}
+
+/**
+ * @brief Overrides the standard library function posix_memalign with my_aligned_alloc.
+ *
+ * @param memptr Where to store the block (output).
+ * @param alignment Alignment, a power of two multiple of sizeof(void *) (input).
+ * @param size Size of the memory to allocate (input).
+ * @return 0, EINVAL for a bad alignment, or ENOMEM.
+ */
+int     posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *ptr = my_aligned_alloc(alignment, size);
+    if (ptr == NULL && size != 0) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include <new>
+#include <cstdlib>
+#include "my_secmalloc.private.h"
+
+/*
+ * Global operator new and delete for the preload build.
+ *
+ * Every form goes straight to the allocator: plain new to my_malloc and the
+ * slabs, aligned new to my_aligned_alloc, sized delete to msm_free_sized.
+ * The library does not link libstdc++, so C programs preloading it do not
+ * load it: the two libstdc++ functions used on allocation failure are weak
+ * references, resolved in the C++ programs that call operator new at all.
+ */
+
+#ifdef DYNAMIC
+
+namespace std {
+new_handler get_new_handler() noexcept __attribute__((weak));
+void __throw_bad_alloc() __attribute__((weak, noreturn));
+}
+
+/**
+ * @brief Allocates for operator new, calling the new-handler until it gives up.
+ *
+ * @param size Requested size, 0 giving a unique block (input).
+ * @param alignment Requested alignment, 16 for the unaligned forms (input).
+ * @param nothrow Return NULL rather than throw std::bad_alloc (input).
+ * @return The block, or NULL for the nothrow forms.
+ */
+static void *new_impl(std::size_t size, std::size_t alignment, bool nothrow) {
+    if (size == 0) {
+        size = 1;
+    }
+    for (;;) {
+        void *ptr = alignment <= 16 ? my_malloc(size) : my_aligned_alloc(alignment, size);
+        if (ptr != nullptr) {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler ? std::get_new_handler() : nullptr;
+        if (handler == nullptr) {
+            if (nothrow) {
+                return nullptr;
+            }
+            if (std::__throw_bad_alloc) {
+                std::__throw_bad_alloc();
+            }
+            std::abort();
+        }
+        handler();
+    }
+}
+
+void *operator new(std::size_t size) {
+    return new_impl(size, 16, false);
+}
+
+void *operator new[](std::size_t size) {
+    return new_impl(size, 16, false);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return new_impl(size, 16, true);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return new_impl(size, 16, true);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+    return new_impl(size, static_cast<std::size_t>(alignment), false);
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+    return new_impl(size, static_cast<std::size_t>(alignment), false);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return new_impl(size, static_cast<std::size_t>(alignment), true);
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return new_impl(size, static_cast<std::size_t>(alignment), true);
+}
+
+void operator delete(void *ptr) noexcept {
+    my_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    my_free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+    my_free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+    my_free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size) noexcept {
+    msm_free_sized(ptr, size);
+}
+
+void operator delete[](void *ptr, std::size_t size) noexcept {
+    msm_free_sized(ptr, size);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+    my_free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+    my_free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept {
+    my_free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept {
+    my_free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size, std::align_val_t) noexcept {
+    msm_free_sized(ptr, size);
+}
+
+void operator delete[](void *ptr, std::size_t size, std::align_val_t) noexcept {
+    msm_free_sized(ptr, size);
+}
+
+#endif
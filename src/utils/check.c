@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include "my_secmalloc.private.h"
+
+/**
+ * @brief Totals gathered while walking the page map.
+ */
+struct heap_census {
+    size_t pages[PAGE_LARGE + 1];   /**< Pages of each kind. */
+    size_t free_chunks;             /**< FREE chunks found in chunk pages. */
+    int errors;                     /**< Inconsistencies found so far. */
+};
+
+/**
+ * @brief Tells whether a free-list link points into a chunk page of a heap.
+ */
+static int link_in_heap(struct chunk *chunk, int heap) {
+    struct page_info info = pagemap_lookup(chunk);
+    return info.kind == PAGE_CHUNK && info.owner == heap;
+}
+
+/**
+ * @brief Checks that a free chunk is linked both ways with its free-list neighbours.
+ */
+static int free_chunk_linked(struct chunk *chunk, int heap) {
+    if (chunk->prev == NULL ? free_lists[heap] != chunk : !link_in_heap(chunk->prev, heap) || chunk->prev->next != chunk) {
+        return 0;
+    }
+    return chunk->next == NULL || (link_in_heap(chunk->next, heap) && chunk->next->prev == chunk);
+}
+
+/**
+ * @brief Checks the chunks of a chunk page.
+ *
+ * @param page Chunk page (input).
+ * @param heap Heap owning the page (input).
+ * @param free_chunks Incremented for each FREE chunk found, may be NULL (input/output).
+ * @return The first chunk with a corrupted header, a size running past the
+ * page, a free chunk smaller than 16 bytes or broken free-list links, or NULL
+ * if the page is consistent.
+ *
+ * The caller must hold the heap lock.
+ */
+struct chunk *check_chunk_page(char *page, int heap, size_t *free_chunks) {
+    char *cursor = page;
+
+    while (cursor + CHUNK_SIZE <= page + PAGE_SIZE) {
+        struct chunk *chunk = (struct chunk *)cursor;
+        if (chunk->canary_start != CANARY_VALUE || chunk->canary_end != CANARY_VALUE
+            || (chunk->flags != FREE && chunk->flags != BUSY) || chunk->size > PAGE_SIZE - CHUNK_SIZE
+            || cursor + CHUNK_SIZE + chunk->size > page + PAGE_SIZE) {
+            return chunk;
+        }
+        if (chunk->flags == FREE) {
+            if (chunk->size < 16 || !free_chunk_linked(chunk, heap)) {
+                return chunk;
+            }
+            if (free_chunks != NULL) {
+                (*free_chunks)++;
+            }
+        }
+        cursor += CHUNK_SIZE + chunk->size;
+    }
+    return cursor == page + PAGE_SIZE ? NULL : (struct chunk *)cursor;
+}
+
+/**
+ * @brief Checks the header of a large allocation and that all its pages are mapped.
+ *
+ * @param page Page where the data starts, recorded as LARGE_HEAD (input).
+ * @param owner Offset of the data in that page (input).
+ * @return The header of the allocation if it is corrupted or its pages are
+ * missing from the page map, NULL otherwise.
+ *
+ * The caller must hold the heap lock.
+ */
+struct chunk *check_large_head(char *page, int owner) {
+    char *data = page + owner;
+    struct chunk *chunk = (struct chunk *)data - 1;
+    char *base = (char *)((uintptr_t)chunk & ~(uintptr_t)(PAGE_SIZE - 1));
+
+    if (chunk->canary_start != CANARY_VALUE || chunk->canary_end != CANARY_VALUE || chunk->flags != BUSY
+        || ((uintptr_t)(data + chunk->size) & (PAGE_SIZE - 1)) != 0) {
+        return chunk;
+    }
+    for (char *cursor = base; cursor < data + chunk->size; cursor += PAGE_SIZE) {
+        struct page_info info = pagemap_lookup(cursor);
+        if (info.kind != PAGE_LARGE || (info.size_class == LARGE_HEAD) != (cursor == page)) {
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+static void census_page(void *page, struct page_info info, void *arg) {
+    struct heap_census *census = arg;
+    struct chunk *bad;
+
+    census->pages[info.kind]++;
+    if (info.kind == PAGE_CHUNK) {
+        if (info.owner >= MSM_HEAP_COUNT) {
+            debug_print(1, "chunk page %p: owned by unknown heap %d", page, info.owner);
+            census->errors++;
+        } else if ((bad = check_chunk_page(page, info.owner, &census->free_chunks)) != NULL) {
+            debug_print(1, "chunk page %p: corrupted chunk at %p", page, (void *)bad);
+            census->errors++;
+        }
+    } else if (info.kind == PAGE_LARGE && info.size_class == LARGE_HEAD) {
+        if ((bad = check_large_head(page, info.owner)) != NULL) {
+            debug_print(1, "large allocation %p: corrupted header or missing pages", (void *)(bad + 1));
+            census->errors++;
+        }
+    }
+}
+
+/**
+ * @brief Checks the consistency of the whole heap.
+ *
+ * @return Number of inconsistencies found, each reported with debug_print.
+ *
+ * Verifies that each heap's free list is acyclic, correctly back-linked and
+ * only holds free chunks of that heap's chunk pages; that the chunks of every chunk page tile
+ * it with intact headers, and every free one is on the free list; the slab
+ * bitmaps and slot headers; the headers of large allocations; and that the
+ * mapped byte count matches the pages in the page map. The last check only
+ * holds when no other thread is using the allocator.
+ */
+int heap_check_invariants(void) {
+    struct heap_census census;
+    size_t slab_pages = 0;
+    size_t listed = 0;
+
+    memset(&census, 0, sizeof(census));
+    HEAP_LOCK();
+    pagemap_for_each(census_page, &census);
+
+    for (int heap = 0; heap < MSM_HEAP_COUNT; heap++) {
+        struct chunk *prev = NULL;
+        for (struct chunk *chunk = free_lists[heap]; chunk != NULL; prev = chunk, chunk = chunk->next) {
+            struct page_info info = pagemap_lookup(chunk);
+            if (++listed > census.free_chunks) {
+                debug_print(1, "free list %d: longer than the number of free chunks, or cyclic", heap);
+                census.errors++;
+                break;
+            }
+            if (info.kind != PAGE_CHUNK || info.owner != heap || chunk->flags != FREE || chunk->prev != prev
+                || chunk->canary_start != CANARY_VALUE || chunk->canary_end != CANARY_VALUE) {
+                debug_print(1, "free list %d: bad entry %p", heap, (void *)chunk);
+                census.errors++;
+                break;
+            }
+        }
+    }
+    if (listed != census.free_chunks) {
+        debug_print(1, "free list: %zu entries for %zu free chunks", listed, census.free_chunks);
+        census.errors++;
+    }
+
+    census.errors += slab_check_invariants(&slab_pages);
+    if (slab_pages != census.pages[PAGE_SLAB]) {
+        debug_print(1, "slabs: %zu pages in use, %zu in the page map", slab_pages, census.pages[PAGE_SLAB]);
+        census.errors++;
+    }
+
+    size_t pages = census.pages[PAGE_CHUNK] + census.pages[PAGE_SLAB] + census.pages[PAGE_RT_POOL] + census.pages[PAGE_LARGE];
+    size_t mapped = msm_mapped_bytes();
+    if (mapped != pages * PAGE_SIZE) {
+        debug_print(1, "limits: %zu bytes accounted, %zu mapped", mapped, pages * PAGE_SIZE);
+        census.errors++;
+    }
+    HEAP_UNLOCK();
+    return census.errors;
+}
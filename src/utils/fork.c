@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "my_secmalloc.private.h"
+
+static int fork_handlers_registered = 0;
+static int purge_on_fork = 0;
+
+/**
+ * @brief Runs in the parent before fork().
+ *
+ * Takes the heap lock, then the rt-pool locks and the histogram registry
+ * lock, so that no other thread is in the middle of updating the free lists
+ * when the address space is copied. When purge on fork is enabled, fully
+ * free pages are unmapped first so the child neither inherits them nor
+ * copies them on write. The mapped-bytes deltas of all threads are folded,
+ * since the child loses every thread but the caller.
+ */
+static void fork_prepare(void) {
+    HEAP_LOCK();
+    if (purge_on_fork) {
+        purge_free_pages();
+    }
+    limits_atfork_prepare();
+    rt_atfork_prepare();
+#if MSM_HISTOGRAMS
+    histograms_atfork_prepare();
+#endif
+}
+
+/**
+ * @brief Runs in the parent after fork().
+ */
+static void fork_parent(void) {
+#if MSM_HISTOGRAMS
+    histograms_atfork_parent();
+#endif
+    rt_atfork_parent();
+    HEAP_UNLOCK();
+}
+
+/**
+ * @brief Runs in the child after fork().
+ *
+ * The child only has the thread that called fork(), which is not the owner
+ * recorded in the inherited recursive mutex, so the lock is re-created
+ * instead of being released. Per-thread allocator state belonging to
+ * threads that do not exist in the child is reset here as well.
+ */
+static void fork_child(void) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&heap_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    rt_atfork_child();
+    limits_atfork_child();
+    slab_atfork_child();
+#if MSM_HISTOGRAMS
+    histograms_atfork_child();
+#endif
+#if MSM_SCRUBBER
+    scrubber_atfork_child();
+#endif
+}
+
+/**
+ * @brief Installs the pthread_atfork handlers once.
+ *
+ * Called by heap_bootstrap and msm_rt_pool_create, with the heap lock held,
+ * so a process that only allocates from pools is covered as well.
+ * The "MSM_PURGE_ON_FORK" environment variable enables purging free pages
+ * before fork; msm_set_fork_purge() can change it later.
+ */
+void register_fork_handlers(void) {
+    if (fork_handlers_registered) {
+        return;
+    }
+    fork_handlers_registered = 1;
+    char *purge = getenv("MSM_PURGE_ON_FORK");
+    if (purge != NULL && strcmp(purge, "0") != 0) {
+        purge_on_fork = 1;
+    }
+    if (pthread_atfork(fork_prepare, fork_parent, fork_child) != 0) {
+        log_execution_report(1, "register_fork_handlers: pthread_atfork failed", 0, NULL);
+    }
+}
+
+/**
+ * @brief Enables or disables purging fully free pages before fork().
+ *
+ * @param enabled Non-zero to purge before fork (input).
+ */
+void msm_set_fork_purge(int enabled) {
+    HEAP_LOCK();
+    purge_on_fork = enabled != 0;
+    HEAP_UNLOCK();
+}
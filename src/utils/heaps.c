@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+#include "my_secmalloc.private.h"
+
+/*
+ * Lifetime-segregated heaps.
+ *
+ * Each heap has its own free list and its own chunk pages, recorded as the
+ * page's owner in the page map. Blocks that are freed together then share
+ * pages, which empty out and can be purged, instead of being pinned by a
+ * long-lived neighbour.
+ */
+
+/**
+ * @brief Picks the heap serving a set of allocation hints.
+ *
+ * MSM_HOT wins over the lifetime hints, so hot blocks stay packed whatever
+ * their lifetime; hints that contradict each other are ignored.
+ */
+int heap_for_hints(unsigned hints) {
+    if (hints & MSM_HOT) {
+        return MSM_HEAP_HOT;
+    }
+    switch (hints & (MSM_SHORT_LIVED | MSM_LONG_LIVED)) {
+        case MSM_SHORT_LIVED:
+            return MSM_HEAP_SHORT_LIVED;
+        case MSM_LONG_LIVED:
+            return MSM_HEAP_LONG_LIVED;
+        default:
+            return MSM_HEAP_DEFAULT;
+    }
+}
+
+/**
+ * @brief Allocates memory from the heap matching the caller's hints.
+ *
+ * @param size Size of the memory to allocate (input).
+ * @param hints MSM_SHORT_LIVED, MSM_LONG_LIVED and/or MSM_HOT (input).
+ * @return Pointer to the allocated memory block, or NULL if allocation fails.
+ *
+ * The block is freed and resized with my_free and my_realloc; my_realloc
+ * keeps it in its heap.
+ */
+void *msm_malloc_hint(size_t size, unsigned hints) {
+    int heap = heap_for_hints(hints);
+#if MSM_HISTOGRAMS
+    if (hist_enabled && !hist_depth) {
+        uint64_t start = hist_begin();
+        void *ptr = heap_malloc(size, heap);
+        hist_record(MSM_OP_MALLOC, size, start);
+        return ptr;
+    }
+#endif
+    return heap_malloc(size, heap);
+}
+
+static void count_page(void *page, struct page_info info, void *arg) {
+    struct msm_heap_stats *stats = arg;
+
+    if (info.kind != PAGE_CHUNK || info.owner >= MSM_HEAP_COUNT) {
+        return;
+    }
+    stats = &stats[info.owner];
+    stats->pages++;
+    stats->empty_pages += chunk_page_is_free(page);
+    for (char *cursor = page; cursor + CHUNK_SIZE <= (char *)page + PAGE_SIZE;) {
+        struct chunk *chunk = (struct chunk *)cursor;
+        if (chunk->flags == FREE) {
+            stats->free_bytes += chunk->size;
+        } else {
+            stats->busy_bytes += chunk->size;
+        }
+        cursor += CHUNK_SIZE + chunk->size;
+    }
+}
+
+/**
+ * @brief Reports how full the pages of each heap are.
+ *
+ * @param out One entry per heap, indexed by enum msm_heap_id (output).
+ * @return MSM_HEAP_COUNT.
+ *
+ * A heap whose empty_pages stays close to its pages, or whose pages_purged
+ * follows its pages_mapped, empties out well. Walks every chunk page, so it
+ * is meant for monitoring, not for hot paths.
+ */
+int msm_heap_stats(struct msm_heap_stats out[MSM_HEAP_COUNT]) {
+    memset(out, 0, MSM_HEAP_COUNT * sizeof(*out));
+    HEAP_LOCK();
+    pagemap_for_each(count_page, out);
+    for (int heap = 0; heap < MSM_HEAP_COUNT; heap++) {
+        out[heap].pages_mapped = heap_pages_mapped[heap];
+        out[heap].pages_purged = heap_pages_purged[heap];
+    }
+    HEAP_UNLOCK();
+    return MSM_HEAP_COUNT;
+}
@@ -3,66 +3,112 @@
 #include <stdlib.h>
 #include "my_secmalloc.private.h"
 
-
-
 extern struct chunk *metadata_pages;
 extern struct chunk *data_pages;
-extern struct chunk *free_list;
+int heap_ready = 0;
+uint64_t heap_pages_mapped[MSM_HEAP_COUNT];
+uint64_t heap_pages_purged[MSM_HEAP_COUNT];
 
 /**
  * @brief Allocates a new memory page for metadata or data.
  * 
+ * @param heap Heap the page belongs to, recorded as its page map owner (input).
  * @return struct chunk* Pointer to the newly allocated page, or NULL if allocation fails.
  * 
  * This function uses `mmap` to allocate a new memory page. It logs an error message 
  * if the allocation fails and a success message if the allocation is successful.
+ * The page is accounted against the memory limits first, and is refused with
+ * ENOMEM when it would exceed the hard limit, and recorded in the page map.
  */
-struct chunk *allocate_page() {
+struct chunk *allocate_page(int heap) {
+    if (!limit_reserve(PAGE_SIZE)) {
+        return NULL;
+    }
     struct chunk *page = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (page == MAP_FAILED) {
+        limit_release(PAGE_SIZE);
         log_execution_report(1,"Failed to allocate page", PAGE_SIZE - CHUNK_SIZE, page);
         return NULL;
     }
+    if (!pagemap_set(page, PAGE_SIZE, PAGE_CHUNK, 0, heap)) {
+        munmap(page, PAGE_SIZE);
+        limit_release(PAGE_SIZE);
+        return NULL;
+    }
+    heap_pages_mapped[heap]++;
     log_execution_report(2,"Allocated page :",PAGE_SIZE - CHUNK_SIZE, page);
     return page;
 }
 
 /**
- * @brief Initializes the metadata pages.
- * 
- * This function allocates a new page for metadata and initializes its fields.
- * If the allocation fails, the function terminates the program.
- * The new metadata page is also added to the free list.
+ * @brief Turns a fresh chunk page into one free chunk and pushes it onto the free list.
+ *
+ * @param page Page returned by allocate_page or part of the bootstrap region (input).
+ * @param heap Heap owning the page (input).
  */
-void initialize_metadata() {
-    metadata_pages = allocate_page();
-    if (metadata_pages == NULL) {
-        exit(EXIT_FAILURE);
+void push_free_page(struct chunk *page, int heap) {
+    page->size = PAGE_SIZE - CHUNK_SIZE;
+    page->flags = FREE;
+    page->canary_start = CANARY_VALUE;
+    page->canary_end = CANARY_VALUE;
+    page->prev = NULL;
+    page->next = free_lists[heap];
+    if (free_lists[heap]) {
+        free_lists[heap]->prev = page;
     }
-    metadata_pages->size = PAGE_SIZE - CHUNK_SIZE;
-    metadata_pages->flags = FREE;
-    metadata_pages->canary_start = CANARY_VALUE;
-    metadata_pages->canary_end = CANARY_VALUE;
-    metadata_pages->next = NULL;
-    metadata_pages->prev = NULL;
-    free_list = metadata_pages;
+    free_lists[heap] = page;
 }
 
 /**
- * @brief Initializes the data pages.
- * 
- * This function allocates a new page for data and initializes its fields.
- * If the allocation fails, the function terminates the program.
+ * @brief Sets up the allocator on first use.
+ *
+ * Called by my_malloc while heap_ready is still 0. One mapping holds the
+ * first two chunk pages (metadata_pages, then data_pages) followed by the
+ * page map root, so a new process pays a single mmap for all of them.
+ * heap_ready is published before the fork handlers, histograms and scrubber
+ * are set up, as pthread_atfork may allocate and re-enter my_malloc on this
+ * thread; other threads wait on the heap lock until the bootstrap is over.
+ * If the region cannot be mapped, the program is terminated.
  */
-void initialize_data() {
-    data_pages = allocate_page();
-    if (data_pages == NULL) {
+void heap_bootstrap(void) {
+    HEAP_LOCK();
+    if (heap_ready) {
+        HEAP_UNLOCK();
+        return;
+    }
+    limits_init();
+    memops_init();
+    size_t pages = BOOTSTRAP_PAGES * PAGE_SIZE;
+    if (!limit_reserve(pages)) {
+        exit(EXIT_FAILURE);
+    }
+    char *region = mmap(NULL, pages + PAGEMAP_ROOT_BYTES, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+        log_execution_report(1, "heap_bootstrap: failed to map the initial region", pages, NULL);
+        exit(EXIT_FAILURE);
+    }
+    if (!pagemap_adopt_root(region + pages)) {
+        /* A pool created before the first my_malloc already mapped the root. */
+        munmap(region + pages, PAGEMAP_ROOT_BYTES);
+    }
+    if (!pagemap_set(region, pages, PAGE_CHUNK, 0, MSM_HEAP_DEFAULT)) {
         exit(EXIT_FAILURE);
     }
-    data_pages->size = PAGE_SIZE - CHUNK_SIZE;
-    data_pages->flags = FREE;
-    data_pages->canary_start = CANARY_VALUE;
-    data_pages->canary_end = CANARY_VALUE;
-    data_pages->next = NULL;
-    data_pages->prev = NULL;
-}
\ No newline at end of file
+    heap_pages_mapped[MSM_HEAP_DEFAULT] += BOOTSTRAP_PAGES;
+    metadata_pages = (struct chunk *)region;
+    data_pages = (struct chunk *)(region + PAGE_SIZE);
+    push_free_page(data_pages, MSM_HEAP_DEFAULT);
+    push_free_page(metadata_pages, MSM_HEAP_DEFAULT);
+    log_execution_report(2, "heap_bootstrap", pages, region);
+    __atomic_store_n(&heap_ready, 1, __ATOMIC_RELEASE);
+
+    register_fork_handlers();
+#if MSM_HISTOGRAMS
+    histograms_init();
+#endif
+#if MSM_SCRUBBER
+    scrubber_init();
+#endif
+    HEAP_UNLOCK();
+}
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include "my_secmalloc.private.h"
+
+/**
+ * @brief Returns the start of the page holding an address.
+ */
+static char *page_of(const void *ptr) {
+    return (char *)((uintptr_t)ptr & ~(uintptr_t)(PAGE_SIZE - 1));
+}
+
+/**
+ * @brief Rounds a length up to a whole number of pages.
+ */
+static size_t round_to_pages(size_t length) {
+    return (length + PAGE_SIZE - 1) & ~((size_t)PAGE_SIZE - 1);
+}
+
+/**
+ * @brief Records a large allocation in the page map.
+ *
+ * @param base First page of the mapping (input).
+ * @param mapped Length of the mapping (input).
+ * @param data Start of the block (input).
+ * @return 1 on success, 0 if the map could not grow.
+ */
+static int large_record(char *base, size_t mapped, char *data) {
+    return pagemap_set(base, mapped, PAGE_LARGE, 0, 0)
+        && pagemap_set(page_of(data), PAGE_SIZE, PAGE_LARGE, LARGE_HEAD, (int)((uintptr_t)data & (PAGE_SIZE - 1)));
+}
+
+/**
+ * @brief Allocates a request that does not fit in a chunk page.
+ *
+ * @param size Requested size, above LARGE_THRESHOLD unless alignment is (input).
+ * @param alignment Alignment of the block, a power of two of at least 16 (input).
+ * @return Pointer to zeroed memory, or NULL with errno set to ENOMEM.
+ *
+ * The request gets its own mapping, a struct chunk header followed by the
+ * data, recorded as PAGE_LARGE in the page map. The page where the data
+ * starts is marked LARGE_HEAD, with the data's offset in the page as its
+ * owner. With the default alignment the header opens the mapping; larger
+ * alignments map extra room, place the data and give the unused pages
+ * back. The caller must hold the heap lock.
+ */
+void *large_malloc(size_t size, size_t alignment) {
+    size_t slack = alignment > 16 ? alignment : 0;
+
+    if (size > SIZE_MAX - CHUNK_SIZE - slack - PAGE_SIZE) {
+        return NULL;
+    }
+    size_t length = round_to_pages(CHUNK_SIZE + size + slack);
+    if (!limit_reserve(length)) {
+        return NULL;
+    }
+    char *start = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (start == MAP_FAILED) {
+        limit_release(length);
+        log_execution_report(1, "large_malloc: mmap failed", size, NULL);
+        return NULL;
+    }
+    char *data = (char *)(((uintptr_t)start + CHUNK_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    struct chunk *chunk = (struct chunk *)data - 1;
+    char *base = page_of(chunk);
+    char *end = (char *)round_to_pages((size_t)(data + size));
+    if (base > start) {
+        munmap(start, (size_t)(base - start));
+    }
+    if (end < start + length) {
+        munmap(end, (size_t)(start + length - end));
+    }
+    size_t mapped = (size_t)(end - base);
+    limit_release(length - mapped);
+    if (!large_record(base, mapped, data)) {
+        pagemap_clear(base, mapped);
+        munmap(base, mapped);
+        limit_release(mapped);
+        return NULL;
+    }
+    chunk->size = (size_t)(end - data);
+    chunk->canary_start = CANARY_VALUE;
+    chunk->canary_end = CANARY_VALUE;
+    chunk->next = NULL;
+    chunk->prev = NULL;
+    chunk->flags = BUSY;
+    log_execution_report(2, "large_malloc", chunk->size, data);
+    return data;
+}
+
+/**
+ * @brief Returns a large allocation to the kernel.
+ *
+ * @param ptr Pointer into a page the page map records as PAGE_LARGE (input).
+ *
+ * The caller must hold the heap lock. Pointers that are not the start of a
+ * large allocation and corrupted headers are reported and ignored; a second
+ * free finds the pages gone from the page map and never gets here.
+ */
+void large_free(void *ptr) {
+    struct chunk *chunk = (struct chunk *)ptr - 1;
+
+    if (!large_is_block(ptr, pagemap_lookup(ptr))) {
+        log_execution_report(1, "large_free error: Invalid free: not a large allocation", 0, ptr);
+        return;
+    }
+#if MSM_CHECKS
+    if (chunk->canary_start != CANARY_VALUE || chunk->canary_end != CANARY_VALUE || chunk->flags != BUSY) {
+        log_execution_report(1, "my_free error: Invalid free or corrupted memory", chunk->size, chunk);
+        return;
+    }
+#endif
+    char *base = page_of(chunk);
+    size_t mapped = (size_t)((char *)ptr + chunk->size - base);
+    HIST_SIZE(chunk->size);
+    pagemap_clear(base, mapped);
+    munmap(base, mapped);
+    limit_release(mapped);
+    log_execution_report(2, "large_free", mapped, ptr);
+}
+
+/**
+ * @brief Moves a large block by copying it, when mremap cannot move it.
+ *
+ * The copy goes through memops_copy, which bypasses the caches for large
+ * blocks.
+ */
+static void *large_copy(void *ptr, size_t size) {
+    size_t old_size = ((struct chunk *)ptr - 1)->size;
+    void *moved = large_malloc(size, 16);
+
+    if (moved == NULL) {
+        return NULL;
+    }
+    memops_copy(moved, ptr, old_size < size ? old_size : size);
+    large_free(ptr);
+    return moved;
+}
+
+/**
+ * @brief Resizes a large allocation, letting the kernel move its pages.
+ *
+ * @param ptr Start of a large allocation (input).
+ * @param size New size, above LARGE_THRESHOLD (input).
+ * @return The block, possibly moved, or NULL with ptr left untouched.
+ *
+ * mremap relocates the page tables instead of copying the data. The block
+ * keeps its offset in the page, so alignments above a page are not kept
+ * when it moves. When mremap fails, the block is copied to a new mapping.
+ * The caller must hold the heap lock.
+ */
+void *large_realloc(void *ptr, size_t size) {
+    struct chunk *chunk = (struct chunk *)ptr - 1;
+    char *base = page_of(chunk);
+    size_t offset = (size_t)((char *)ptr - base);
+    size_t old_mapped = offset + chunk->size;
+
+    if (size > SIZE_MAX - offset - PAGE_SIZE) {
+        return NULL;
+    }
+    size_t mapped = round_to_pages(offset + size);
+    if (mapped == old_mapped) {
+        return ptr;
+    }
+    if (mapped > old_mapped && !limit_reserve(mapped - old_mapped)) {
+        return NULL;
+    }
+    char *moved = mremap(base, old_mapped, mapped, MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED) {
+        if (mapped > old_mapped) {
+            limit_release(mapped - old_mapped);
+        }
+        log_execution_report(1, "large_realloc: mremap failed, copying", size, ptr);
+        return large_copy(ptr, size);
+    }
+    pagemap_clear(base, old_mapped);
+    if (!large_record(moved, mapped, moved + offset)) {
+        /* Put the block back where it was; the leaves covering that range exist. */
+        mremap(moved, mapped, old_mapped, MREMAP_MAYMOVE | MREMAP_FIXED, base);
+        large_record(base, old_mapped, ptr);
+        if (mapped > old_mapped) {
+            limit_release(mapped - old_mapped);
+        }
+        return NULL;
+    }
+    if (mapped < old_mapped) {
+        limit_release(old_mapped - mapped);
+    }
+    chunk = (struct chunk *)(moved + offset) - 1;
+    chunk->size = mapped - offset;
+    log_execution_report(2, "large_realloc", chunk->size, chunk + 1);
+    return chunk + 1;
+}
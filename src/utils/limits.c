@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include "my_secmalloc.private.h"
+
+/**
+ * @brief Per-thread deltas are folded into mapped_bytes once they reach this size.
+ *
+ * Limits are therefore enforced with a slack of at most one batch per thread.
+ */
+#define LIMIT_BATCH (256 * 1024L)
+
+
+/**
+ * @brief Bytes mapped or unmapped by one thread and not yet folded.
+ *
+ * Tracked threads are linked together so fork_prepare can fold all of them.
+ * The list and every delta are only touched with the heap lock held.
+ */
+struct thread_delta {
+    long bytes;                 /**< Unfolded byte count, negative after unmappings. */
+    int tracked;                /**< 1 once the thread is on the list. */
+    struct thread_delta *prev;  /**< Previous tracked thread. */
+    struct thread_delta *next;  /**< Next tracked thread. */
+};
+
+/*
+ * Signed: a thread may unmap, and fold, memory that another thread mapped
+ * before that thread folds its own delta.
+ */
+static long mapped_bytes = 0;
+static __thread struct thread_delta mapped_delta;
+static struct thread_delta *thread_deltas = NULL;
+static pthread_key_t delta_key;
+static int delta_key_created = 0;
+static size_t soft_limit = 0;
+static size_t hard_limit = 0;
+static int over_soft_limit = 0;
+static int limits_initialized = 0;
+static void (*soft_limit_callback)(size_t mapped, void *arg) = NULL;
+static void *soft_limit_arg = NULL;
+
+/**
+ * @brief Parses a byte count with an optional K, M or G suffix.
+ *
+ * @return The value, or 0 (no limit) when the string is not a number.
+ */
+static size_t parse_size(const char *value) {
+    char *end = NULL;
+    unsigned long long bytes = strtoull(value, &end, 10);
+    if (end == value) {
+        return 0;
+    }
+    switch (*end) {
+        case 'k': case 'K': bytes <<= 10; break;
+        case 'm': case 'M': bytes <<= 20; break;
+        case 'g': case 'G': bytes <<= 30; break;
+        default: break;
+    }
+    return (size_t)bytes;
+}
+
+/**
+ * @brief Moves a thread's delta into the global counter.
+ *
+ * The caller must hold the heap lock.
+ */
+static void fold_delta(struct thread_delta *delta) {
+    __atomic_add_fetch(&mapped_bytes, delta->bytes, __ATOMIC_RELAXED);
+    delta->bytes = 0;
+}
+
+/**
+ * @brief pthread key destructor: folds the delta of an exiting thread and
+ * takes it off the list.
+ */
+static void fold_exiting_delta(void *arg) {
+    struct thread_delta *delta = arg;
+
+    HEAP_LOCK();
+    fold_delta(delta);
+    if (delta->prev != NULL) {
+        delta->prev->next = delta->next;
+    } else {
+        thread_deltas = delta->next;
+    }
+    if (delta->next != NULL) {
+        delta->next->prev = delta->prev;
+    }
+    delta->tracked = 0;
+    HEAP_UNLOCK();
+}
+
+/**
+ * @brief Puts the calling thread's delta on the list and makes sure it is
+ * folded when the thread exits.
+ *
+ * The caller must hold the heap lock.
+ */
+static void track_thread(void) {
+    if (mapped_delta.tracked) {
+        return;
+    }
+    mapped_delta.tracked = 1;
+    mapped_delta.prev = NULL;
+    mapped_delta.next = thread_deltas;
+    if (thread_deltas != NULL) {
+        thread_deltas->prev = &mapped_delta;
+    }
+    thread_deltas = &mapped_delta;
+    if (!delta_key_created) {
+        delta_key_created = pthread_key_create(&delta_key, fold_exiting_delta) == 0;
+    }
+    if (delta_key_created) {
+        pthread_setspecific(delta_key, &mapped_delta);
+    }
+}
+
+/**
+ * @brief Returns the mapped byte count as seen by the calling thread.
+ */
+static size_t current_mapped(void) {
+    long total = __atomic_load_n(&mapped_bytes, __ATOMIC_RELAXED) + mapped_delta.bytes;
+    return total > 0 ? (size_t)total : 0;
+}
+
+/**
+ * @brief Coalesces physically adjacent free chunks of the same page.
+ *
+ * The caller must hold the heap lock. Every free chunk is on the free list
+ * of its page's heap, so merging each one with the free chunks that follow
+ * it in its page visits every pair once.
+ */
+static void coalesce_free_chunks(void) {
+    for (int heap = 0; heap < MSM_HEAP_COUNT; heap++) {
+        for (struct chunk *current = free_lists[heap]; current != NULL; current = current->next) {
+            char *page_end = (char *)((uintptr_t)current & ~(uintptr_t)(PAGE_SIZE - 1)) + PAGE_SIZE;
+            for (;;) {
+                struct chunk *next = (struct chunk *)((char *)(current + 1) + current->size);
+                if ((char *)next + CHUNK_SIZE > page_end || next->flags != FREE || next->canary_start != CANARY_VALUE) {
+                    break;
+                }
+                unlink_chunk(next);
+                current->size += CHUNK_SIZE + next->size;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Reacts to the soft limit being crossed.
+ *
+ * Free chunks are coalesced and fully free pages unmapped, then the user
+ * callback, if any, is told how much is still mapped. The callback runs with
+ * the heap lock held and may free memory. It is called again only after the
+ * mapped size has gone back under the soft limit.
+ */
+static void soft_limit_pressure(void) {
+    coalesce_free_chunks();
+    purge_free_pages();
+    if (soft_limit_callback != NULL) {
+        soft_limit_callback(current_mapped(), soft_limit_arg);
+    }
+}
+
+/**
+ * @brief Reads "MSM_SOFT_LIMIT" and "MSM_HARD_LIMIT" once.
+ */
+void limits_init(void) {
+    if (limits_initialized) {
+        return;
+    }
+    limits_initialized = 1;
+    char *soft = getenv("MSM_SOFT_LIMIT");
+    char *hard = getenv("MSM_HARD_LIMIT");
+    if (soft != NULL) {
+        soft_limit = parse_size(soft);
+    }
+    if (hard != NULL) {
+        hard_limit = parse_size(hard);
+    }
+}
+
+/**
+ * @brief Accounts for a mapping about to be made.
+ *
+ * @param bytes Size of the mapping (input).
+ * @return 1 if the mapping may proceed, 0 with errno set to ENOMEM if it would
+ * exceed the hard limit.
+ *
+ * The caller must hold the heap lock.
+ */
+int limit_reserve(size_t bytes) {
+    if (hard_limit != 0 && current_mapped() + bytes > hard_limit) {
+        if (soft_limit != 0) {
+            soft_limit_pressure();
+        }
+        if (current_mapped() + bytes > hard_limit) {
+            log_execution_report(1, "limit_reserve: hard limit reached", bytes, NULL);
+            errno = ENOMEM;
+            return 0;
+        }
+    }
+    track_thread();
+    mapped_delta.bytes += (long)bytes;
+    if (mapped_delta.bytes >= LIMIT_BATCH) {
+        fold_delta(&mapped_delta);
+    }
+    if (soft_limit != 0 && current_mapped() > soft_limit) {
+        if (!over_soft_limit) {
+            over_soft_limit = 1;
+            log_execution_report(1, "limit_reserve: soft limit crossed", current_mapped(), NULL);
+            soft_limit_pressure();
+        }
+    } else {
+        over_soft_limit = 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Accounts for a mapping that has been removed.
+ *
+ * @param bytes Size of the mapping (input).
+ */
+void limit_release(size_t bytes) {
+    track_thread();
+    mapped_delta.bytes -= (long)bytes;
+    if (mapped_delta.bytes <= -LIMIT_BATCH) {
+        fold_delta(&mapped_delta);
+    }
+}
+
+/**
+ * @brief Folds the delta of every tracked thread before fork().
+ *
+ * Called by fork_prepare with the heap lock held, so the child inherits a
+ * counter that includes the threads it will not have.
+ */
+void limits_atfork_prepare(void) {
+    for (struct thread_delta *delta = thread_deltas; delta != NULL; delta = delta->next) {
+        fold_delta(delta);
+    }
+}
+
+/**
+ * @brief Drops the threads that did not survive fork() from the list.
+ *
+ * Their deltas were folded by limits_atfork_prepare.
+ */
+void limits_atfork_child(void) {
+    thread_deltas = NULL;
+    if (mapped_delta.tracked) {
+        mapped_delta.prev = NULL;
+        mapped_delta.next = NULL;
+        thread_deltas = &mapped_delta;
+    }
+}
+
+/**
+ * @brief Sets the soft and hard limits on mapped bytes.
+ *
+ * @param soft Soft limit in bytes, 0 for none (input).
+ * @param hard Hard limit in bytes, 0 for none (input).
+ * @return 0, or -1 with errno set to EINVAL when soft is above hard.
+ */
+int msm_set_limits(size_t soft, size_t hard) {
+    if (soft != 0 && hard != 0 && soft > hard) {
+        errno = EINVAL;
+        return -1;
+    }
+    HEAP_LOCK();
+    limits_initialized = 1;
+    soft_limit = soft;
+    hard_limit = hard;
+    over_soft_limit = 0;
+    HEAP_UNLOCK();
+    return 0;
+}
+
+/**
+ * @brief Registers the function called when the soft limit is crossed.
+ *
+ * @param callback Function to call, or NULL to remove it (input).
+ * @param arg Opaque argument passed back to callback (input).
+ */
+void msm_set_soft_limit_callback(void (*callback)(size_t mapped, void *arg), void *arg) {
+    HEAP_LOCK();
+    soft_limit_callback = callback;
+    soft_limit_arg = arg;
+    HEAP_UNLOCK();
+}
+
+/**
+ * @brief Returns the number of bytes currently mapped by the allocator.
+ */
+size_t msm_mapped_bytes(void) {
+    HEAP_LOCK();
+    fold_delta(&mapped_delta);
+    size_t mapped = current_mapped();
+    HEAP_UNLOCK();
+    return mapped;
+}
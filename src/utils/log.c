@@ -8,26 +8,31 @@
 
 extern FILE *execution_report;
 
+#if MSM_LOGGING
+static int report_opened = 0;
+
 /**
- * @brief Initializes the execution report file.
- * 
- * This function is automatically called when the library is loaded.
- * It attempts to open the file specified by the "MSM_OUTPUT" environment variable
- * for writing and assigns the file pointer to `execution_report`.
- * If the file cannot be opened, it writes an error message to `stderr` and exits.
+ * @brief Opens the execution report file named by "MSM_OUTPUT".
+ *
+ * Called by the first log_execution_report, so processes that never log
+ * pay neither the getenv nor the fopen. Only the first caller opens the
+ * file: fopen may allocate, and the log calls of that nested my_malloc find
+ * the report still closed and are dropped. If the file cannot be opened,
+ * an error message is written to `stderr` and the program exits.
  */
- __attribute__((constructor))
-void init_execution_report() {
+static void open_execution_report(void) {
+    if (__atomic_exchange_n(&report_opened, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
     char *report_filename = getenv("MSM_OUTPUT");
     if (report_filename != NULL) {
-        if (execution_report == NULL) {
-            execution_report = fopen(report_filename, "w");
-            if (execution_report == NULL) {          
-                write(STDERR_FILENO, "Failed to open execution report file\n", 38);
-                exit(EXIT_FAILURE);
-            }
+        FILE *report = fopen(report_filename, "w");
+        if (report == NULL) {
+            write(STDERR_FILENO, "Failed to open execution report file\n", 38);
+            exit(EXIT_FAILURE);
         }
-    }    
+        __atomic_store_n(&execution_report, report, __ATOMIC_RELEASE);
+    }
 }
 
 /**
@@ -44,6 +49,8 @@ void close_execution_report() {
     }
 }
 
+#endif
+
 /**
  * @brief Retrieves code string based on the given value.
  * 
@@ -79,11 +86,19 @@ static const char* get_code(int value) {
  * It includes the function type, size, and address in the log message. If the file
  * cannot write the expected number of bytes, it writes an error message to `stderr`.
  */
+#if MSM_LOGGING
 void log_execution_report(int value, const char *func_type, size_t size, void *addr) {
     char message_buffer[256];
     char full_message_buffer[512];
     const char *reset_code = "";
 
+    if (__builtin_expect(!__atomic_load_n(&report_opened, __ATOMIC_ACQUIRE), 0)) {
+        open_execution_report();
+    }
+    FILE *report = __atomic_load_n(&execution_report, __ATOMIC_ACQUIRE);
+    if (report == NULL) {
+        return;
+    }
     snprintf(message_buffer, sizeof(message_buffer), "Function: %s, Size: %zu, Address: %p", func_type, size, addr);
     if (value == 3) {
         snprintf(message_buffer, sizeof(message_buffer), "Function: %s", func_type);
@@ -92,15 +107,14 @@ void log_execution_report(int value, const char *func_type, size_t size, void *a
         snprintf(full_message_buffer, sizeof(full_message_buffer), "%s %s%s\n", get_code(value), message_buffer, reset_code);
     }
 
-    if (execution_report != NULL) {
-        int fd = fileno(execution_report);
-        size_t written = write(fd, full_message_buffer, strlen(full_message_buffer));
-        if (written != strlen(full_message_buffer)) {
-            write(STDERR_FILENO, "write did not write the expected number of bytes\n", 50);
-        }
-        fsync(fd);
+    int fd = fileno(report);
+    size_t written = write(fd, full_message_buffer, strlen(full_message_buffer));
+    if (written != strlen(full_message_buffer)) {
+        write(STDERR_FILENO, "write did not write the expected number of bytes\n", 50);
     }
+    fsync(fd);
 }
+#endif
 
 /**
  * @brief Prints a debug message to the standard output.
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include "my_secmalloc.private.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Sizes from which zeroing and copying bypass the caches.
+ *
+ * Below them memset and memcpy are used: libc's cached stores win on small
+ * buffers, which the caller is likely to touch again soon.
+ * bench/bench_memops.c prints the crossovers of the build machine, and
+ * MSM_NT_ZERO_THRESHOLD and MSM_NT_COPY_THRESHOLD override them at startup.
+ */
+size_t memops_zero_threshold = MSM_NT_ZERO_THRESHOLD_DEFAULT;
+size_t memops_copy_threshold = MSM_NT_COPY_THRESHOLD_DEFAULT;
+
+#if defined(__x86_64__)
+
+/**
+ * @brief Number of bytes to handle with cached stores before dst is aligned.
+ */
+static size_t head_length(void *dst, size_t alignment, size_t n) {
+    size_t head = (alignment - ((uintptr_t)dst & (alignment - 1))) & (alignment - 1);
+    return head < n ? head : n;
+}
+
+__attribute__((target("avx512f")))
+static void zero_avx512(void *dst, size_t n) {
+    size_t head = head_length(dst, 64, n);
+    memset(dst, 0, head);
+    char *cursor = (char *)dst + head;
+    size_t body = (n - head) & ~(size_t)255;
+    __m512i zero = _mm512_setzero_si512();
+    for (char *end = cursor + body; cursor < end; cursor += 256) {
+        _mm512_stream_si512((void *)cursor, zero);
+        _mm512_stream_si512((void *)(cursor + 64), zero);
+        _mm512_stream_si512((void *)(cursor + 128), zero);
+        _mm512_stream_si512((void *)(cursor + 192), zero);
+    }
+    _mm_sfence();
+    memset(cursor, 0, n - head - body);
+}
+
+__attribute__((target("avx2")))
+static void zero_avx2(void *dst, size_t n) {
+    size_t head = head_length(dst, 32, n);
+    memset(dst, 0, head);
+    char *cursor = (char *)dst + head;
+    size_t body = (n - head) & ~(size_t)127;
+    __m256i zero = _mm256_setzero_si256();
+    for (char *end = cursor + body; cursor < end; cursor += 128) {
+        _mm256_stream_si256((__m256i *)cursor, zero);
+        _mm256_stream_si256((__m256i *)(cursor + 32), zero);
+        _mm256_stream_si256((__m256i *)(cursor + 64), zero);
+        _mm256_stream_si256((__m256i *)(cursor + 96), zero);
+    }
+    _mm_sfence();
+    memset(cursor, 0, n - head - body);
+}
+
+static void zero_sse2(void *dst, size_t n) {
+    size_t head = head_length(dst, 16, n);
+    memset(dst, 0, head);
+    char *cursor = (char *)dst + head;
+    size_t body = (n - head) & ~(size_t)63;
+    __m128i zero = _mm_setzero_si128();
+    for (char *end = cursor + body; cursor < end; cursor += 64) {
+        _mm_stream_si128((__m128i *)cursor, zero);
+        _mm_stream_si128((__m128i *)(cursor + 16), zero);
+        _mm_stream_si128((__m128i *)(cursor + 32), zero);
+        _mm_stream_si128((__m128i *)(cursor + 48), zero);
+    }
+    _mm_sfence();
+    memset(cursor, 0, n - head - body);
+}
+
+__attribute__((target("avx512f")))
+static void copy_avx512(void *dst, const void *src, size_t n) {
+    size_t head = head_length(dst, 64, n);
+    memcpy(dst, src, head);
+    char *out = (char *)dst + head;
+    const char *in = (const char *)src + head;
+    size_t body = (n - head) & ~(size_t)127;
+    for (char *end = out + body; out < end; out += 128, in += 128) {
+        __m512i a = _mm512_loadu_si512((const void *)in);
+        __m512i b = _mm512_loadu_si512((const void *)(in + 64));
+        _mm512_stream_si512((void *)out, a);
+        _mm512_stream_si512((void *)(out + 64), b);
+    }
+    _mm_sfence();
+    memcpy(out, in, n - head - body);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2(void *dst, const void *src, size_t n) {
+    size_t head = head_length(dst, 32, n);
+    memcpy(dst, src, head);
+    char *out = (char *)dst + head;
+    const char *in = (const char *)src + head;
+    size_t body = (n - head) & ~(size_t)63;
+    for (char *end = out + body; out < end; out += 64, in += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)in);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(in + 32));
+        _mm256_stream_si256((__m256i *)out, a);
+        _mm256_stream_si256((__m256i *)(out + 32), b);
+    }
+    _mm_sfence();
+    memcpy(out, in, n - head - body);
+}
+
+static void copy_sse2(void *dst, const void *src, size_t n) {
+    size_t head = head_length(dst, 16, n);
+    memcpy(dst, src, head);
+    char *out = (char *)dst + head;
+    const char *in = (const char *)src + head;
+    size_t body = (n - head) & ~(size_t)63;
+    for (char *end = out + body; out < end; out += 64, in += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)in);
+        __m128i b = _mm_loadu_si128((const __m128i *)(in + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(in + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(in + 48));
+        _mm_stream_si128((__m128i *)out, a);
+        _mm_stream_si128((__m128i *)(out + 16), b);
+        _mm_stream_si128((__m128i *)(out + 32), c);
+        _mm_stream_si128((__m128i *)(out + 48), d);
+    }
+    _mm_sfence();
+    memcpy(out, in, n - head - body);
+}
+
+/*
+ * Resolvers run before the sanitizer runtimes are initialized, so they must
+ * not be instrumented.
+ */
+#define RESOLVER __attribute__((no_sanitize_address, no_sanitize_thread, no_sanitize_undefined))
+
+/**
+ * @brief Picks the widest non-temporal zeroing kernel the CPU supports.
+ *
+ * Runs once, when the dynamic loader (or the static startup code) resolves
+ * memops_zero_nt, before any constructor.
+ */
+static RESOLVER void (*resolve_zero_nt(void))(void *, size_t) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return zero_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return zero_avx2;
+    }
+    return zero_sse2;
+}
+
+/**
+ * @brief Picks the widest non-temporal copy kernel the CPU supports.
+ */
+static RESOLVER void (*resolve_copy_nt(void))(void *, const void *, size_t) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return copy_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return copy_avx2;
+    }
+    return copy_sse2;
+}
+
+void memops_zero_nt(void *dst, size_t n) __attribute__((ifunc("resolve_zero_nt")));
+void memops_copy_nt(void *dst, const void *src, size_t n) __attribute__((ifunc("resolve_copy_nt")));
+
+/**
+ * @brief Names the kernels selected for this CPU.
+ */
+const char *memops_kernel_name(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return "avx512";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return "avx2";
+    }
+    return "sse2";
+}
+
+#else
+
+void memops_zero_nt(void *dst, size_t n) {
+    memset(dst, 0, n);
+}
+
+void memops_copy_nt(void *dst, const void *src, size_t n) {
+    memcpy(dst, src, n);
+}
+
+const char *memops_kernel_name(void) {
+    return "scalar";
+}
+
+#endif
+
+/**
+ * @brief Replaces a threshold with the byte count held by an environment variable, if any.
+ */
+static void read_threshold(const char *name, size_t *threshold) {
+    char *value = getenv(name);
+    if (value != NULL) {
+        char *end = NULL;
+        unsigned long long bytes = strtoull(value, &end, 10);
+        if (end != value) {
+            *threshold = (size_t)bytes;
+        }
+    }
+}
+
+/**
+ * @brief Reads "MSM_NT_ZERO_THRESHOLD" and "MSM_NT_COPY_THRESHOLD" once.
+ */
+void memops_init(void) {
+    read_threshold("MSM_NT_ZERO_THRESHOLD", &memops_zero_threshold);
+    read_threshold("MSM_NT_COPY_THRESHOLD", &memops_copy_threshold);
+}
@@ -0,0 +1,64 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include "my_secmalloc.private.h"
+
+/**
+ * @brief Allocates memory aligned to a power of two.
+ *
+ * @param alignment Alignment of the block, a power of two (input).
+ * @param size Size of the memory to allocate (input).
+ * @param heap Heap serving the request, an enum msm_heap_id (input).
+ * @return Pointer to the allocated memory block, or NULL with errno set to
+ * EINVAL for a bad alignment, ENOMEM when the allocation fails.
+ */
+static void *aligned_alloc_impl(size_t alignment, size_t size, int heap) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        log_execution_report(1, "my_aligned_alloc error: alignment is not a power of two", alignment, NULL);
+        errno = EINVAL;
+        return NULL;
+    }
+    return heap_memalign(alignment, size, heap);
+}
+
+/**
+ * @brief Allocates memory aligned to a power of two.
+ *
+ * @param alignment Alignment of the block, a power of two (input).
+ * @param size Size of the memory to allocate (input).
+ * @return Pointer to the allocated memory block, or NULL on failure.
+ *
+ * Entry point around aligned_alloc_impl that records the call's latency, as
+ * a malloc, when the histograms are enabled. The block is freed and resized
+ * with my_free and my_realloc; my_realloc does not keep alignments above 16.
+ */
+void *my_aligned_alloc(size_t alignment, size_t size) {
+#if MSM_HISTOGRAMS
+    if (hist_enabled && !hist_depth) {
+        uint64_t start = hist_begin();
+        void *ptr = aligned_alloc_impl(alignment, size, MSM_HEAP_DEFAULT);
+        hist_record(MSM_OP_MALLOC, size, start);
+        return ptr;
+    }
+#endif
+    return aligned_alloc_impl(alignment, size, MSM_HEAP_DEFAULT);
+}
+
+/**
+ * @brief Allocates aligned memory from the heap matching the caller's hints.
+ *
+ * @param alignment Alignment of the block, a power of two (input).
+ * @param size Size of the memory to allocate (input).
+ * @param hints MSM_SHORT_LIVED, MSM_LONG_LIVED and/or MSM_HOT, as for msm_malloc_hint (input).
+ * @return Pointer to the allocated memory block, or NULL on failure.
+ */
+void *msm_aligned_alloc(size_t alignment, size_t size, unsigned hints) {
+#if MSM_HISTOGRAMS
+    if (hist_enabled && !hist_depth) {
+        uint64_t start = hist_begin();
+        void *ptr = aligned_alloc_impl(alignment, size, heap_for_hints(hints));
+        hist_record(MSM_OP_MALLOC, size, start);
+        return ptr;
+    }
+#endif
+    return aligned_alloc_impl(alignment, size, heap_for_hints(hints));
+}
@@ -12,7 +12,7 @@
  * This function combines the functionality of malloc and memset, ensuring that all allocated memory is zeroed out.
  * It logs the operation and any potential errors, such as multiplication overflow or allocation failure.
  */
-void *my_calloc(size_t nmemb, size_t size) {
+static void *calloc_impl(size_t nmemb, size_t size) {
     log_execution_report(3,"my_calloc called", size, NULL);
     if (size != 0 && nmemb > SIZE_MAX / size) {
         log_execution_report(1,"my_calloc error: Multiplication overflow",size,NULL);
@@ -21,10 +21,35 @@ void *my_calloc(size_t nmemb, size_t size) {
     size_t total_size = nmemb * size;
     void *ptr = my_malloc(total_size);
     if (ptr) {
-        memset(ptr, 0, total_size);
+        /* Large allocations are fresh mappings, already zeroed by the kernel. */
+        if (pagemap_lookup(ptr).kind != PAGE_LARGE) {
+            memops_zero(ptr, total_size);
+        }
     } else {
         log_execution_report(1,"my_calloc error: Allocation failed",size,ptr);
     }
     log_execution_report(2,"my_calloc allocated and zeroed memory", size,ptr);
     return ptr;
 }
+
+/**
+ * @brief Allocates zeroed memory for an array of nmemb elements of size bytes each.
+ *
+ * @param nmemb Number of elements to allocate (input).
+ * @param size Size of each element in bytes (input).
+ * @return Pointer to the allocated memory, or NULL on failure.
+ *
+ * Entry point around calloc_impl that records the call's latency when the
+ * histograms are enabled.
+ */
+void *my_calloc(size_t nmemb, size_t size) {
+#if MSM_HISTOGRAMS
+    if (hist_enabled && !hist_depth) {
+        uint64_t start = hist_begin();
+        void *ptr = calloc_impl(nmemb, size);
+        hist_record(MSM_OP_CALLOC, nmemb * size, start);
+        return ptr;
+    }
+#endif
+    return calloc_impl(nmemb, size);
+}
@@ -5,24 +5,25 @@
 #include "my_secmalloc.private.h"
 
 
-extern struct chunk *free_list;
 extern struct chunk *metadata_pages;
 
 /**
  * @brief Finds a free chunk of memory of at least the specified size.
  *
  * @param size Size of the memory chunk to find (input).
+ * @param heap Heap whose free list is searched (input).
  * @return Pointer to the found free chunk, or NULL if no suitable chunk is found.
  *
  * This function iterates through the free list to find a chunk that is marked as free
  * and has a size greater than or equal to the requested size.
  */
- struct chunk *find_free_chunk(size_t size) {
+ struct chunk *find_free_chunk(size_t size, int heap) {
 
-    struct chunk *current = free_list;
+    struct chunk *current = free_lists[heap];
     log_execution_report(2, "Find free chunk", size, current);
     while (current != NULL) {
         if (current->flags == FREE && current->size >= size) {
+            HIST_PATH(current == free_lists[heap] ? MSM_PATH_CACHE : MSM_PATH_SEARCH);
             return current;
         }
         current = current->next;
@@ -49,33 +50,112 @@ static void check_free_leak() {
  * @param ptr Pointer to the memory chunk to free (input).
  *
  * This function validates the canary value, checks for double free errors,
- * marks the chunk as free, and updates the free list accordingly.
+ * marks the chunk as free, and pushes it onto the free list of the heap
+ * owning its page.
+ * The page map routes the pointer to its allocator first; pointers it does
+ * not know, such as ones from another malloc, are reported and ignored
+ * without reading memory around them.
  */
- void my_free(void *ptr) {
+ static void free_impl(void *ptr) {
     log_execution_report(3, "my_free called", 0, ptr);
     if (ptr == NULL) {
         return;
     }
+    struct page_info page = pagemap_lookup(ptr);
+    if (page.kind == PAGE_RT_POOL) {
+        struct msm_rt_pool *pool = rt_pool_of(ptr);
+        if (pool != NULL) {
+            HIST_SIZE(rt_usable_size(ptr));
+            rt_free(pool, ptr);
+            return;
+        }
+    }
+    if (page.kind == PAGE_NONE || page.kind == PAGE_RT_POOL
+        || (page.kind == PAGE_CHUNK && ((uintptr_t)ptr & (PAGE_SIZE - 1)) < CHUNK_SIZE)) {
+        log_execution_report(1, "my_free error: Invalid free: pointer not owned by the allocator", 0, ptr);
+        return;
+    }
+    HEAP_LOCK();
+    if (page.kind == PAGE_SLAB) {
+        slab_free(ptr);
+        HEAP_UNLOCK();
+        return;
+    }
+    if (page.kind == PAGE_LARGE) {
+        large_free(ptr);
+        HEAP_UNLOCK();
+        return;
+    }
     struct chunk *metadata_chunk = (struct chunk *)ptr - 1;
+    HIST_SIZE(metadata_chunk->size);
+#if MSM_CHECKS
     if (metadata_chunk->size == 0) {
         log_execution_report(1, "my_free error: Invalid free or corrupted memory", metadata_chunk->size, metadata_chunk);
+        HEAP_UNLOCK();
         return;
     }
     if (metadata_chunk->flags == FREE) {
         log_execution_report(1, "my_free error: Invalid free: Double free detected", metadata_chunk->size, metadata_chunk);
+        HEAP_UNLOCK();
         return;
     }
     if (metadata_chunk->canary_start != CANARY_VALUE || metadata_chunk->canary_end != CANARY_VALUE) {
         log_execution_report(1, "my_free error: Invalid free or corrupted memory", metadata_chunk->size, metadata_chunk);
+        HEAP_UNLOCK();
         return;
     }
+#endif
+    struct chunk **list = &free_lists[page.owner];
     metadata_chunk->flags = FREE;
-    metadata_chunk->next = free_list;
-    if (free_list) {
-        free_list->prev = metadata_chunk;
+    metadata_chunk->next = *list;
+    if (*list) {
+        (*list)->prev = metadata_chunk;
     }
-    free_list = metadata_chunk;
+    *list = metadata_chunk;
     metadata_chunk->prev = NULL;
 
     log_execution_report(2, "my_free freed memory", metadata_chunk->size, ptr);
+    HEAP_UNLOCK();
+}
+
+/**
+ * @brief Frees a block whose size the caller knows, as C++ sized delete does.
+ *
+ * @param ptr Pointer to the memory block to free (input).
+ * @param size Size the block was requested with (input).
+ *
+ * The page map already routes the pointer in constant time, so the size
+ * adds no faster path; the checked profiles use it to catch a delete that
+ * does not match its new, and refuse to free a block smaller than claimed.
+ */
+void msm_free_sized(void *ptr, size_t size) {
+#if MSM_CHECKS
+    if (ptr != NULL && msm_malloc_usable_size(ptr) < size) {
+        log_execution_report(1, "msm_free_sized error: Invalid free: block smaller than its size", size, ptr);
+        return;
+    }
+#endif
+    (void)size;
+    my_free(ptr);
+}
+
+/**
+ * @brief Frees a memory chunk previously allocated by my_malloc.
+ *
+ * @param ptr Pointer to the memory chunk to free (input).
+ *
+ * Entry point around free_impl that records the call's latency when the
+ * histograms are enabled.
+ */
+void my_free(void *ptr) {
+#if MSM_HISTOGRAMS
+    if (hist_enabled && !hist_depth && ptr != NULL) {
+        uint64_t start = hist_begin();
+        HIST_SIZE(0);
+        free_impl(ptr);
+        hist_record(MSM_OP_FREE, hist_size, start);
+        return;
+    }
+#endif
+    free_impl(ptr);
 }
@@ -5,8 +5,6 @@
 #include <unistd.h> // For sysconf
 #include "my_secmalloc.private.h"
 
-extern struct chunk *free_list;
-
 /**
  * @brief Reallocates a memory block previously allocated by my_malloc or my_calloc.
  *
@@ -17,12 +15,16 @@ extern struct chunk *free_list;
  * This function reallocates the memory block pointed to by ptr to the new size specified by size.
  * If ptr is NULL, it behaves like my_malloc(size).
  * If size is 0, it behaves like my_free(ptr).
+ * Pointers the page map does not attribute to the allocator are refused.
  * It validates the canary value of the metadata chunk to ensure memory integrity.
- * If the new size is the same as the current size, it returns ptr without reallocation.
+ * If the new size is the same as the current size, or still fits the slab slot
+ * holding ptr, it returns ptr without reallocation. Large blocks that stay
+ * large are resized with mremap. A block of a hinted heap is moved within
+ * that heap.
  * Otherwise, it allocates a new memory block of the requested size, copies the data from the
  * old block to the new block, frees the old block, and returns the new block.
  */
-void *my_realloc(void *ptr, size_t size) {
+static void *realloc_impl(void *ptr, size_t size) {
     log_execution_report(3, "my_realloc called", size, ptr);
 
     if (ptr == NULL) {
@@ -34,25 +36,61 @@ void *my_realloc(void *ptr, size_t size) {
         return NULL;
     }
 
+    struct page_info page = pagemap_lookup(ptr);
+    if (page.kind == PAGE_NONE || (page.kind == PAGE_RT_POOL && rt_pool_of(ptr) == NULL)
+        || (page.kind == PAGE_CHUNK && ((uintptr_t)ptr & (PAGE_SIZE - 1)) < CHUNK_SIZE)
+        || (page.kind == PAGE_LARGE && !large_is_block(ptr, page))) {
+        log_execution_report(1, "my_realloc error: Invalid realloc: pointer not owned by the allocator", size, ptr);
+        return NULL;
+    }
+
+    if (page.kind == PAGE_RT_POOL) {
+        size_t old_size = rt_usable_size(ptr);
+        if (old_size >= size) {
+            HIST_PATH(MSM_PATH_CACHE);
+            return ptr;
+        }
+        void *new_ptr = my_malloc(size);
+        if (new_ptr) {
+            memops_copy(new_ptr, ptr, old_size < size ? old_size : size);
+            my_free(ptr);
+        }
+        return new_ptr;
+    }
+
     struct chunk *metadata_chunk = (struct chunk *)ptr - 1;
+    HEAP_LOCK();
 
+#if MSM_CHECKS
     if (metadata_chunk->canary_start != CANARY_VALUE || metadata_chunk->canary_end != CANARY_VALUE) {
         log_execution_report(1, "my_realloc error: Invalid realloc or corrupted memory", metadata_chunk->size, metadata_chunk);
+        HEAP_UNLOCK();
         return NULL;
     }
+#endif
 
-    if (metadata_chunk->size == size) {
+    if (page.kind == PAGE_LARGE && size > LARGE_THRESHOLD) {
+        HIST_PATH(MSM_PATH_MAP);
+        void *new_ptr = large_realloc(ptr, size);
+        HEAP_UNLOCK();
+        return new_ptr;
+    }
+
+    if (metadata_chunk->size == size || (page.kind == PAGE_SLAB && size <= metadata_chunk->size)) {
+        HIST_PATH(MSM_PATH_CACHE);
+        HEAP_UNLOCK();
         return ptr;
     }
 
     long page_size = sysconf(_SC_PAGESIZE);
     if (page_size == -1) {
         log_execution_report(1, "my_realloc error: Unable to determine page size", 0, NULL);
+        HEAP_UNLOCK();
         return NULL;
     }
 
-    struct chunk *prev = NULL;
-    struct chunk *curr = free_list;
+    int heap = page.kind == PAGE_CHUNK ? page.owner : MSM_HEAP_DEFAULT;
+    struct chunk *curr = size <= LARGE_THRESHOLD ? free_lists[heap] : NULL;
     struct chunk *free_fit = NULL;
 
     while (curr) {
@@ -61,16 +99,13 @@ void *my_realloc(void *ptr, size_t size) {
                 free_fit = curr;
             }
         }
-        prev = curr;
         curr = curr->next;
     }
 
     if (free_fit) {
-        if (prev) {
-            prev->next = free_fit->next;
-        } else {
-            free_list = free_fit->next;
-        }
+        HIST_PATH(MSM_PATH_SEARCH);
+        unlink_chunk(free_fit);
+        free_fit->flags = BUSY;
 
         void *new_ptr = (void *)(free_fit + 1);
         size_t copy_size = 0;
@@ -79,17 +114,18 @@ void *my_realloc(void *ptr, size_t size) {
         } else {
             copy_size = size;
         }
-        memcpy(new_ptr, ptr, copy_size);
+        memops_copy(new_ptr, ptr, copy_size);
         my_free(ptr);
 
         free_fit->canary_start = CANARY_VALUE;
         free_fit->canary_end = CANARY_VALUE;
 
         log_execution_report(2, "my_realloc reallocated memory to existing free chunk: %p", 0, new_ptr);
+        HEAP_UNLOCK();
         return new_ptr;
     }
 
-    void *new_ptr = my_malloc(size);
+    void *new_ptr = heap == MSM_HEAP_DEFAULT ? my_malloc(size) : heap_malloc(size, heap);
     if (new_ptr) {
         size_t copy_size = 0;
         if (metadata_chunk->size < size) {
@@ -98,7 +134,7 @@ void *my_realloc(void *ptr, size_t size) {
             copy_size = size;
         }
 
-        memcpy(new_ptr, ptr, copy_size);
+        memops_copy(new_ptr, ptr, copy_size);
         my_free(ptr);
         ptr = NULL;
     } else {
@@ -106,5 +142,28 @@ void *my_realloc(void *ptr, size_t size) {
     }
 
     log_execution_report(2, "my_realloc reallocated memory to: %p", 0, new_ptr);
+    HEAP_UNLOCK();
     return new_ptr;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Reallocates a memory block previously allocated by my_malloc or my_calloc.
+ *
+ * @param ptr Pointer to the previously allocated memory block (input).
+ * @param size New size of the memory block (input).
+ * @return Pointer to the reallocated memory block, or NULL if reallocation fails.
+ *
+ * Entry point around realloc_impl that records the call's latency when the
+ * histograms are enabled.
+ */
+void *my_realloc(void *ptr, size_t size) {
+#if MSM_HISTOGRAMS
+    if (hist_enabled && !hist_depth) {
+        uint64_t start = hist_begin();
+        void *new_ptr = realloc_impl(ptr, size);
+        hist_record(MSM_OP_REALLOC, size, start);
+        return new_ptr;
+    }
+#endif
+    return realloc_impl(ptr, size);
+}
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include "my_secmalloc.private.h"
+
+/*
+ * Page map: a two-level radix tree indexed by page number.
+ *
+ * The root and its leaves are mapped lazily with MAP_NORESERVE, so only the
+ * parts covering pages the allocator actually uses are backed by memory.
+ * Entries are written with the heap lock held. Lookups take no lock: leaves
+ * are published with a release store and are never unmapped.
+ */
+
+#define PAGEMAP_ROOT_ENTRIES ((size_t)1 << PAGEMAP_ROOT_BITS)
+#define PAGEMAP_LEAF_ENTRIES ((size_t)1 << PAGEMAP_LEAF_BITS)
+
+struct page_info **pagemap_root = NULL;
+
+/**
+ * @brief Returns the leaf covering a page number, mapping it if needed.
+ *
+ * @return The leaf, or NULL if the root or the leaf cannot be mapped.
+ */
+static struct page_info *pagemap_leaf(uintptr_t page) {
+    if (pagemap_root == NULL) {
+        void *root = mmap(NULL, PAGEMAP_ROOT_BYTES, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (root == MAP_FAILED) {
+            log_execution_report(1, "pagemap: failed to map the root", 0, NULL);
+            return NULL;
+        }
+        __atomic_store_n(&pagemap_root, root, __ATOMIC_RELEASE);
+    }
+    struct page_info **slot = &pagemap_root[page >> PAGEMAP_LEAF_BITS];
+    if (*slot == NULL) {
+        void *leaf = mmap(NULL, PAGEMAP_LEAF_ENTRIES * sizeof(struct page_info), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (leaf == MAP_FAILED) {
+            log_execution_report(1, "pagemap: failed to map a leaf", 0, NULL);
+            return NULL;
+        }
+        __atomic_store_n(slot, leaf, __ATOMIC_RELEASE);
+    }
+    return *slot;
+}
+
+/**
+ * @brief Uses memory mapped by the caller as the root of the map.
+ *
+ * @param root PAGEMAP_ROOT_BYTES of zeroed memory (input).
+ * @return 1 if the root was adopted, 0 if the map already has one.
+ *
+ * Lets heap_bootstrap map the root together with the first heap pages. The
+ * caller must hold the heap lock.
+ */
+int pagemap_adopt_root(void *root) {
+    if (pagemap_root != NULL) {
+        return 0;
+    }
+    __atomic_store_n(&pagemap_root, root, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/**
+ * @brief Records who owns a range of pages.
+ *
+ * @param start First page of the range, page aligned (input).
+ * @param length Length of the range in bytes (input).
+ * @param kind Allocator owning the pages (input).
+ * @param size_class Size class of slab pages, 0 otherwise (input).
+ * @param owner Index of the owning pool or heap (input).
+ * @return 1 on success, 0 if the map could not grow.
+ *
+ * The caller must hold the heap lock.
+ */
+int pagemap_set(void *start, size_t length, enum page_kind kind, int size_class, int owner) {
+    uintptr_t first = (uintptr_t)start >> PAGEMAP_PAGE_SHIFT;
+    uintptr_t last = ((uintptr_t)start + length - 1) >> PAGEMAP_PAGE_SHIFT;
+
+    if (last >> (PAGEMAP_ROOT_BITS + PAGEMAP_LEAF_BITS)) {
+        log_execution_report(1, "pagemap: address out of range", length, start);
+        return 0;
+    }
+    for (uintptr_t page = first; page <= last; page++) {
+        struct page_info *leaf = pagemap_leaf(page);
+        if (leaf == NULL) {
+            return 0;
+        }
+        struct page_info *info = &leaf[page & (PAGEMAP_LEAF_ENTRIES - 1)];
+        info->kind = (uint8_t)kind;
+        info->size_class = (uint8_t)size_class;
+        info->owner = (uint16_t)owner;
+    }
+    return 1;
+}
+
+/**
+ * @brief Forgets a range of pages that is being unmapped.
+ *
+ * @param start First page of the range, page aligned (input).
+ * @param length Length of the range in bytes (input).
+ */
+void pagemap_clear(void *start, size_t length) {
+    uintptr_t first = (uintptr_t)start >> PAGEMAP_PAGE_SHIFT;
+    uintptr_t last = ((uintptr_t)start + length - 1) >> PAGEMAP_PAGE_SHIFT;
+
+    if (pagemap_root == NULL) {
+        return;
+    }
+    for (uintptr_t page = first; page <= last; page++) {
+        struct page_info *leaf = pagemap_root[page >> PAGEMAP_LEAF_BITS];
+        if (leaf != NULL) {
+            leaf[page & (PAGEMAP_LEAF_ENTRIES - 1)].kind = PAGE_NONE;
+        }
+    }
+}
+
+/**
+ * @brief Calls a function on the pages recorded in part of the map.
+ *
+ * @param from Page number to start from, 0 for the start of the map (input).
+ * @param pages Maximum number of recorded pages to visit (input).
+ * @param entries Maximum number of map entries to examine; leaves that are not
+ * mapped are skipped for free (input).
+ * @param visit Function called with the page address and its entry (input).
+ * @param arg Opaque argument passed back to visit (input).
+ * @return Page number to resume from, or 0 once the end of the map is reached.
+ *
+ * Lets a caller spread a walk of the whole map over several calls, releasing
+ * the heap lock in between. The caller must hold the heap lock.
+ */
+uintptr_t pagemap_walk(uintptr_t from, size_t pages, size_t entries,
+                       void (*visit)(void *page, struct page_info info, void *arg), void *arg) {
+    if (pagemap_root == NULL) {
+        return 0;
+    }
+    for (uintptr_t page = from; page >> (PAGEMAP_ROOT_BITS + PAGEMAP_LEAF_BITS) == 0;) {
+        struct page_info *leaf = pagemap_root[page >> PAGEMAP_LEAF_BITS];
+        if (leaf == NULL) {
+            page = ((page >> PAGEMAP_LEAF_BITS) + 1) << PAGEMAP_LEAF_BITS;
+            continue;
+        }
+        if (pages == 0 || entries == 0) {
+            return page;
+        }
+        struct page_info info = leaf[page & (PAGEMAP_LEAF_ENTRIES - 1)];
+        if (info.kind != PAGE_NONE) {
+            visit((void *)(page << PAGEMAP_PAGE_SHIFT), info, arg);
+            pages--;
+        }
+        entries--;
+        page++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Calls a function on every page recorded in the map.
+ *
+ * @param visit Function called with the page address and its entry (input).
+ * @param arg Opaque argument passed back to visit (input).
+ *
+ * Scans every mapped leaf, so it is meant for checks and debugging, not for
+ * the allocation paths. The caller must hold the heap lock.
+ */
+void pagemap_for_each(void (*visit)(void *page, struct page_info info, void *arg), void *arg) {
+    pagemap_walk(0, SIZE_MAX, SIZE_MAX, visit, arg);
+}
+
+/**
+ * @brief Returns the number of bytes usable in a block.
+ *
+ * @param ptr Pointer returned by my_malloc, my_calloc or my_realloc (input).
+ * @return Usable size, or 0 for NULL and for pointers the allocator does not own.
+ *
+ * Slab slots are answered from the page map alone, without touching the block.
+ */
+size_t msm_malloc_usable_size(void *ptr) {
+    struct page_info page = pagemap_lookup(ptr);
+
+    switch (page.kind) {
+        case PAGE_SLAB:
+            return slab_class_size(page.size_class);
+        case PAGE_RT_POOL:
+            return rt_pool_of(ptr) != NULL ? rt_usable_size(ptr) : 0;
+        case PAGE_CHUNK:
+            if (((uintptr_t)ptr & (PAGE_SIZE - 1)) < CHUNK_SIZE) {
+                return 0;
+            }
+            return ((struct chunk *)ptr - 1)->size;
+        case PAGE_LARGE:
+            if (!large_is_block(ptr, page)) {
+                return 0;
+            }
+            return ((struct chunk *)ptr - 1)->size;
+        default:
+            return 0;
+    }
+}
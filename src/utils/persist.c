@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include "my_secmalloc.private.h"
+
+/*
+ * Persistent heaps: shared heaps kept in a regular file and always mapped at
+ * the address they were formatted at, so raw pointers stored in the heap
+ * stay valid from one run of the program to the next.
+ *
+ * The header's dirty flag is set and synced when the heap is opened and
+ * cleared by a clean close. A heap found dirty was not closed cleanly, and
+ * goes through the canary-checked recovery pass of shared heaps before use.
+ * One process at a time may have a persistent heap open: the file is locked
+ * with flock for as long as it is. The locked descriptor only means something
+ * in this process, so it is kept in a small table keyed by the heap's
+ * address rather than in the file.
+ */
+
+#ifndef MAP_FIXED_NOREPLACE
+# define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define PERSIST_MAX_OPEN 16
+
+/**
+ * @brief Persistent heap open in this process, and the descriptor locking its file.
+ */
+struct persist_slot {
+    struct msm_shm_heap *heap; /**< Heap address, NULL while the open is in progress. */
+    int fd;                    /**< Locked descriptor. */
+    int used;                  /**< 1 while the slot is taken. */
+};
+
+static struct persist_slot persist_slots[PERSIST_MAX_OPEN];
+static pthread_mutex_t persist_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Reserves a slot of the table for a descriptor.
+ *
+ * @param fd Locked descriptor of the heap being opened (input).
+ * @return Index of the slot, or -1 when PERSIST_MAX_OPEN heaps are already open.
+ */
+static int persist_slot_take(int fd) {
+    int index = -1;
+
+    pthread_mutex_lock(&persist_lock);
+    for (int i = 0; i < PERSIST_MAX_OPEN; i++) {
+        if (!persist_slots[i].used) {
+            persist_slots[i].heap = NULL;
+            persist_slots[i].fd = fd;
+            persist_slots[i].used = 1;
+            index = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&persist_lock);
+    return index;
+}
+
+/**
+ * @brief Frees a slot of the table and closes its descriptor.
+ *
+ * @param index Index returned by persist_slot_take (input).
+ */
+static void persist_slot_release(int index) {
+    pthread_mutex_lock(&persist_lock);
+    int fd = persist_slots[index].fd;
+    persist_slots[index].heap = NULL;
+    persist_slots[index].used = 0;
+    pthread_mutex_unlock(&persist_lock);
+    close(fd);
+}
+
+/**
+ * @brief Finds the slot of an open heap.
+ *
+ * @param heap Heap returned by msm_persist_open (input).
+ * @return Index of its slot, or -1 if the heap is not open in this process.
+ */
+static int persist_slot_find(struct msm_shm_heap *heap) {
+    int index = -1;
+
+    pthread_mutex_lock(&persist_lock);
+    for (int i = 0; i < PERSIST_MAX_OPEN; i++) {
+        if (persist_slots[i].used && persist_slots[i].heap == heap) {
+            index = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&persist_lock);
+    return index;
+}
+
+/**
+ * @brief Opens a persistent heap, creating it when the file is empty.
+ *
+ * @param path File holding the heap (input).
+ * @param size Size of a new heap, ignored when the file already holds one (input).
+ * @param base Address of a new heap, NULL for MSM_PERSIST_DEFAULT_BASE; an
+ * existing heap is mapped where it was created (input).
+ * @return The heap, or NULL with errno set: EBUSY when another process has it
+ * open, EMFILE when PERSIST_MAX_OPEN heaps are already open, EEXIST when its address range is taken in this process, EINVAL when
+ * the file is not a heap, EIO when recovery found it corrupted. A file that
+ * was empty is left empty on failure, so it can be opened again as new.
+ */
+struct msm_shm_heap *msm_persist_open(const char *path, size_t size, void *base) {
+    struct msm_shm_heap header;
+    struct stat st;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        errno = EBUSY;
+        return NULL;
+    }
+    int slot = persist_slot_take(fd);
+    if (slot < 0) {
+        close(fd);
+        errno = EMFILE;
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) {
+        int error = errno;
+        persist_slot_release(slot);
+        errno = error;
+        return NULL;
+    }
+    int fresh = st.st_size == 0;
+    if (fresh) {
+        size = size & ~(size_t)(PAGE_SIZE - 1);
+        base = base != NULL ? base : MSM_PERSIST_DEFAULT_BASE;
+        if (size < shm_min_size()) {
+            persist_slot_release(slot);
+            errno = EINVAL;
+            return NULL;
+        }
+        if (ftruncate(fd, (off_t)size) != 0) {
+            int error = errno;
+            persist_slot_release(slot);
+            errno = error;
+            return NULL;
+        }
+    } else {
+        if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+            || !shm_header_valid(&header, (size_t)st.st_size)) {
+            log_execution_report(1, "msm_persist_open error: not a persistent heap", (size_t)st.st_size, NULL);
+            persist_slot_release(slot);
+            errno = EINVAL;
+            return NULL;
+        }
+        size = (size_t)st.st_size;
+        base = (void *)(uintptr_t)header.base;
+    }
+
+    struct msm_shm_heap *heap = mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (heap != MAP_FAILED && heap != base) {
+        /* Kernels before 4.17 take MAP_FIXED_NOREPLACE as a mere hint. */
+        munmap(heap, size);
+        heap = MAP_FAILED;
+        errno = EEXIST;
+    }
+    if (heap == MAP_FAILED) {
+        int error = errno;
+        log_execution_report(1, "msm_persist_open error: base address unavailable", size, base);
+        if (fresh && ftruncate(fd, 0) != 0) {
+            log_execution_report(1, "msm_persist_open error: could not empty the new file", size, NULL);
+        }
+        persist_slot_release(slot);
+        errno = error;
+        return NULL;
+    }
+
+    if (fresh) {
+        shm_format(heap, size);
+    } else {
+        /* Whatever the lock held when the file was last written is meaningless now. */
+        shm_init_lock(heap);
+        if (heap->dirty && !shm_recover(heap)) {
+            munmap(heap, size);
+            persist_slot_release(slot);
+            errno = EIO;
+            return NULL;
+        }
+    }
+    pthread_mutex_lock(&persist_lock);
+    persist_slots[slot].heap = heap;
+    pthread_mutex_unlock(&persist_lock);
+    heap->dirty = 1;
+    msync(heap, PAGE_SIZE, MS_SYNC);
+    log_execution_report(2, "msm_persist_open", size, heap);
+    return heap;
+}
+
+/**
+ * @brief Writes the heap back to its file.
+ *
+ * @param heap Heap returned by msm_persist_open (input).
+ * @return 0, or -1 with errno set by msync.
+ */
+int msm_persist_sync(struct msm_shm_heap *heap) {
+    return msync(heap, (size_t)heap->size, MS_SYNC);
+}
+
+/**
+ * @brief Closes a persistent heap cleanly, so the next open skips recovery.
+ *
+ * @param heap Heap returned by msm_persist_open (input).
+ */
+void msm_persist_close(struct msm_shm_heap *heap) {
+    if (heap == NULL) {
+        return;
+    }
+    int slot = persist_slot_find(heap);
+    if (slot < 0) {
+        log_execution_report(1, "msm_persist_close error: heap not open in this process", 0, heap);
+        return;
+    }
+    size_t size = (size_t)heap->size;
+    pthread_mutex_lock(&heap->lock);
+    msync(heap, size, MS_SYNC);
+    heap->dirty = 0;
+    pthread_mutex_unlock(&heap->lock);
+    msync(heap, PAGE_SIZE, MS_SYNC);
+    munmap(heap, size);
+    persist_slot_release(slot);
+}
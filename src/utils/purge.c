@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include "my_secmalloc.private.h"
+
+extern struct chunk *metadata_pages;
+extern struct chunk *data_pages;
+
+/**
+ * @brief Returns the start of the page holding a chunk.
+ */
+static char *page_of(struct chunk *chunk) {
+    return (char *)((uintptr_t)chunk & ~(uintptr_t)(PAGE_SIZE - 1));
+}
+
+/**
+ * @brief Checks whether every chunk of a page is free.
+ *
+ * @param page Start of the page (input).
+ * @return 1 if the chunks of the page tile it exactly and are all FREE, 0 otherwise.
+ *
+ * The chunks are walked physically from the start of the page, using their
+ * size to find the next header.
+ */
+int chunk_page_is_free(char *page) {
+    char *end = page + PAGE_SIZE;
+    char *cursor = page;
+
+    while (cursor + CHUNK_SIZE <= end) {
+        struct chunk *chunk = (struct chunk *)cursor;
+        if (chunk->flags != FREE || chunk->canary_start != CANARY_VALUE || chunk->canary_end != CANARY_VALUE) {
+            return 0;
+        }
+        cursor += CHUNK_SIZE + chunk->size;
+    }
+    return cursor == end;
+}
+
+/**
+ * @brief Returns the fully free pages of one heap to the kernel.
+ *
+ * @param heap Heap to purge (input).
+ * @return Number of bytes unmapped.
+ */
+static size_t purge_heap(int heap) {
+    size_t released = 0;
+    struct chunk *current = free_lists[heap];
+
+    while (current != NULL) {
+        char *page = page_of(current);
+        if (page == (char *)metadata_pages || page == (char *)data_pages || !chunk_page_is_free(page)) {
+            current = current->next;
+            continue;
+        }
+        char *cursor = page;
+        while (cursor < page + PAGE_SIZE) {
+            struct chunk *chunk = (struct chunk *)cursor;
+            cursor += CHUNK_SIZE + chunk->size;
+            unlink_chunk(chunk);
+        }
+        pagemap_clear(page, PAGE_SIZE);
+        munmap(page, PAGE_SIZE);
+        limit_release(PAGE_SIZE);
+        heap_pages_purged[heap]++;
+        released += PAGE_SIZE;
+        log_execution_report(2, "purge_free_pages released page", PAGE_SIZE, page);
+        current = free_lists[heap];
+    }
+    return released;
+}
+
+/**
+ * @brief Returns fully free data pages to the kernel.
+ *
+ * @return Number of bytes unmapped.
+ *
+ * The caller must hold the heap lock. Every page that only contains free
+ * chunks has those chunks removed from its heap's free list and is
+ * unmapped. The pages referenced by metadata_pages and data_pages are kept
+ * so those globals never dangle.
+ */
+size_t purge_free_pages(void) {
+    size_t released = 0;
+
+    for (int heap = 0; heap < MSM_HEAP_COUNT; heap++) {
+        released += purge_heap(heap);
+    }
+    return released;
+}
+
+/**
+ * @brief Public entry point for purge_free_pages.
+ *
+ * @return Number of bytes returned to the kernel.
+ */
+size_t msm_purge(void) {
+    HEAP_LOCK();
+    size_t released = purge_free_pages();
+    HEAP_UNLOCK();
+    return released;
+}
@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "my_secmalloc.private.h"
+
+/*
+ * Background heap scrubber.
+ *
+ * A low-priority thread wakes up every interval and walks part of the page
+ * map, checking the pages it visits: chunk headers, their tiling and the
+ * free-list links of free chunks, busy slab slot headers, and the headers of
+ * large allocations. Corruption is found even in blocks that never reach
+ * my_free or my_realloc, and the allocation paths do no extra work.
+ *
+ * The walk resumes where the previous tick stopped. Each tick takes the heap
+ * lock for batches of a few pages at a time and stops when its time budget
+ * is spent, so a full pass takes several ticks on a large heap. The lock is
+ * only tried: a tick never makes the scrubber wait behind allocating threads.
+ */
+
+#if MSM_SCRUBBER
+
+#define SCRUB_BATCH_PAGES 8
+#define SCRUB_BATCH_ENTRIES 4096
+#define SCRUB_DEFAULT_INTERVAL_MS 100
+#define SCRUB_DEFAULT_BUDGET_US 200
+
+static uintptr_t scrub_cursor = 0;
+static struct msm_scrub_stats scrub_stats;
+
+static pthread_mutex_t scrub_control = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t scrub_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scrub_wake;
+static pthread_t scrub_thread;
+static int scrub_running = 0;
+static int scrub_stopping = 0;
+static unsigned scrub_interval_ms = SCRUB_DEFAULT_INTERVAL_MS;
+static unsigned scrub_budget_us = SCRUB_DEFAULT_BUDGET_US;
+static int scrubber_initialized = 0;
+
+static uint64_t scrub_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Checks one page and reports what is wrong with it.
+ *
+ * The caller holds the heap lock.
+ */
+static void scrub_page(void *page, struct page_info info, void *arg) {
+    int *errors = arg;
+    struct chunk *bad = NULL;
+
+    switch (info.kind) {
+        case PAGE_CHUNK:
+            bad = info.owner < MSM_HEAP_COUNT ? check_chunk_page(page, info.owner, NULL) : page;
+            break;
+        case PAGE_SLAB:
+            bad = slab_check_page(page, info.size_class);
+            break;
+        case PAGE_LARGE:
+            if (info.size_class == LARGE_HEAD) {
+                bad = check_large_head(page, info.owner);
+            }
+            break;
+        default:
+            break;
+    }
+    scrub_stats.pages++;
+    if (bad != NULL) {
+        (*errors)++;
+        scrub_stats.errors++;
+        scrub_stats.last_error = bad;
+        log_execution_report(1, "scrubber error: corrupted header or free-list link", 0, bad);
+    }
+}
+
+/**
+ * @brief Runs one scrubbing tick on the calling thread.
+ *
+ * @param budget_us Time the tick may take, in microseconds (input).
+ * @return Number of corrupted headers and broken links found by the tick.
+ *
+ * Checks batches of pages from where the previous tick stopped until the
+ * budget is spent or the end of the page map is reached, which completes a
+ * pass. The heap lock is released between batches, and the tick ends early
+ * when another thread holds it; the next tick resumes at the same page.
+ */
+int msm_scrub(unsigned budget_us) {
+    uint64_t deadline = scrub_now_us() + budget_us;
+    int errors = 0;
+    uintptr_t cursor;
+
+    do {
+        if (pthread_mutex_trylock(&heap_lock) != 0) {
+            break;
+        }
+        cursor = pagemap_walk(scrub_cursor, SCRUB_BATCH_PAGES, SCRUB_BATCH_ENTRIES, scrub_page, &errors);
+        scrub_cursor = cursor;
+        if (cursor == 0) {
+            scrub_stats.passes++;
+        }
+        HEAP_UNLOCK();
+    } while (cursor != 0 && scrub_now_us() < deadline);
+    return errors;
+}
+
+static void *scrubber_main(void *arg) {
+    struct sched_param param;
+
+    (void)arg;
+    memset(&param, 0, sizeof(param));
+    pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19);
+    pthread_mutex_lock(&scrub_lock);
+    while (!scrub_stopping) {
+        struct timespec wake;
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        wake.tv_sec += scrub_interval_ms / 1000;
+        wake.tv_nsec += (long)(scrub_interval_ms % 1000) * 1000000L;
+        if (wake.tv_nsec >= 1000000000L) {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000L;
+        }
+        while (!scrub_stopping && pthread_cond_timedwait(&scrub_wake, &scrub_lock, &wake) != ETIMEDOUT) {
+        }
+        if (scrub_stopping) {
+            break;
+        }
+        unsigned budget = scrub_budget_us;
+        pthread_mutex_unlock(&scrub_lock);
+        msm_scrub(budget);
+        pthread_mutex_lock(&scrub_lock);
+    }
+    pthread_mutex_unlock(&scrub_lock);
+    return NULL;
+}
+
+/**
+ * @brief Starts the scrubber thread.
+ *
+ * @param interval_ms Time between two ticks, 0 for 100 ms (input).
+ * @param budget_us Time each tick may take, 0 for 200 us (input).
+ * @return 0, or -1 with errno set to EBUSY when the scrubber already runs,
+ * or to the error of pthread_create.
+ *
+ * The thread runs with the SCHED_BATCH policy at nice 19 and all signals
+ * blocked. Unlike SCHED_IDLE, this still gives it a share of a loaded CPU,
+ * so it cannot sit on the heap lock indefinitely after being preempted
+ * mid-batch. It does not survive fork(): a child that wants it must start
+ * it again.
+ */
+int msm_scrubber_start(unsigned interval_ms, unsigned budget_us) {
+    pthread_condattr_t attr;
+    sigset_t all, old;
+    int error;
+
+    pthread_mutex_lock(&scrub_control);
+    if (scrub_running) {
+        pthread_mutex_unlock(&scrub_control);
+        errno = EBUSY;
+        return -1;
+    }
+    scrub_interval_ms = interval_ms != 0 ? interval_ms : SCRUB_DEFAULT_INTERVAL_MS;
+    scrub_budget_us = budget_us != 0 ? budget_us : SCRUB_DEFAULT_BUDGET_US;
+    scrub_stopping = 0;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&scrub_wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    error = pthread_create(&scrub_thread, NULL, scrubber_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (error != 0) {
+        pthread_cond_destroy(&scrub_wake);
+        pthread_mutex_unlock(&scrub_control);
+        log_execution_report(1, "msm_scrubber_start: pthread_create failed", 0, NULL);
+        errno = error;
+        return -1;
+    }
+    scrub_running = 1;
+    pthread_mutex_unlock(&scrub_control);
+    return 0;
+}
+
+/**
+ * @brief Stops the scrubber thread and waits for it to exit.
+ *
+ * Does nothing when the scrubber is not running.
+ */
+void msm_scrubber_stop(void) {
+    pthread_mutex_lock(&scrub_control);
+    if (!scrub_running) {
+        pthread_mutex_unlock(&scrub_control);
+        return;
+    }
+    pthread_mutex_lock(&scrub_lock);
+    scrub_stopping = 1;
+    pthread_cond_signal(&scrub_wake);
+    pthread_mutex_unlock(&scrub_lock);
+    pthread_join(scrub_thread, NULL);
+    pthread_cond_destroy(&scrub_wake);
+    scrub_running = 0;
+    pthread_mutex_unlock(&scrub_control);
+}
+
+/**
+ * @brief Returns the scrubber's counters.
+ *
+ * @param out Destination of the counters (output).
+ * @return 0, or -1 when the scrubber is not compiled into this profile.
+ *
+ * The counters include the ticks run by msm_scrub().
+ */
+int msm_scrubber_stats(struct msm_scrub_stats *out) {
+    HEAP_LOCK();
+    *out = scrub_stats;
+    HEAP_UNLOCK();
+    return 0;
+}
+
+/**
+ * @brief Reads the "MSM_SCRUB" environment variable once.
+ *
+ * "1" starts the scrubber with the default interval and budget,
+ * "<interval ms>,<budget us>" with the given ones, "0" leaves it stopped.
+ * Called by heap_bootstrap, with the heap lock held.
+ */
+void scrubber_init(void) {
+    if (scrubber_initialized) {
+        return;
+    }
+    scrubber_initialized = 1;
+    char *setting = getenv("MSM_SCRUB");
+    if (setting == NULL || strcmp(setting, "0") == 0) {
+        return;
+    }
+    char *end;
+    unsigned long interval = strtoul(setting, &end, 10);
+    unsigned long budget = *end == ',' ? strtoul(end + 1, NULL, 10) : 0;
+    if (interval == 1 && *end == '\0') {
+        interval = 0;
+    }
+    msm_scrubber_start((unsigned)interval, (unsigned)budget);
+}
+
+/**
+ * @brief Forgets the scrubber thread, which did not survive fork().
+ */
+void scrubber_atfork_child(void) {
+    pthread_mutex_init(&scrub_control, NULL);
+    pthread_mutex_init(&scrub_lock, NULL);
+    scrub_running = 0;
+}
+
+#else
+
+int msm_scrubber_start(unsigned interval_ms, unsigned budget_us) {
+    (void)interval_ms;
+    (void)budget_us;
+    errno = ENOSYS;
+    return -1;
+}
+
+void msm_scrubber_stop(void) {
+}
+
+int msm_scrub(unsigned budget_us) {
+    (void)budget_us;
+    return -1;
+}
+
+int msm_scrubber_stats(struct msm_scrub_stats *out) {
+    memset(out, 0, sizeof(*out));
+    return -1;
+}
+
+#endif
@@ -0,0 +1,466 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include "my_secmalloc.private.h"
+
+/*
+ * Shared-memory heaps.
+ *
+ * A heap lives entirely inside one MAP_SHARED mapping of a caller-provided
+ * file descriptor (regular file, shm_open or memfd_create). Every process
+ * may map it at a different address, so chunks are linked by their offset
+ * from the start of the mapping rather than by pointer. A process-shared,
+ * robust mutex in the heap header serialises all processes; if a holder dies
+ * the next one to lock rebuilds the free list from a physical walk of the
+ * chunks before going on.
+ */
+
+#define SHM_MAGIC 0x4d534d5348454150ULL /* "MSMSHEAP" */
+#define SHM_VERSION 2
+#define SHM_ALIGN 16
+#define SHM_MIN_SIZE 16
+#define SHM_CHUNK_SIZE sizeof(struct shm_chunk)
+#define SHM_HEADER_SIZE ((sizeof(struct msm_shm_heap) + 63) & ~(size_t)63)
+
+static size_t shm_align(size_t size) {
+    return (size + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+}
+
+static struct shm_chunk *shm_chunk_at(struct msm_shm_heap *heap, uint64_t offset) {
+    return offset == 0 ? NULL : (struct shm_chunk *)((char *)heap + offset);
+}
+
+static uint64_t shm_offset_of(struct msm_shm_heap *heap, struct shm_chunk *chunk) {
+    return chunk == NULL ? 0 : (uint64_t)((char *)chunk - (char *)heap);
+}
+
+/**
+ * @brief Returns the chunk physically following another, or NULL for the last one.
+ */
+static struct shm_chunk *shm_next_phys(struct msm_shm_heap *heap, struct shm_chunk *chunk) {
+    uint64_t next = shm_offset_of(heap, chunk) + SHM_CHUNK_SIZE + chunk->size;
+    return next + SHM_CHUNK_SIZE <= heap->size ? shm_chunk_at(heap, next) : NULL;
+}
+
+static int shm_chunk_valid(struct shm_chunk *chunk) {
+    return chunk->canary_start == CANARY_VALUE && chunk->canary_end == CANARY_VALUE;
+}
+
+static void shm_set_chunk(struct shm_chunk *chunk, uint64_t size, uint64_t prev_phys, enum chunk_type flags) {
+    chunk->size = size;
+    chunk->prev_phys = prev_phys;
+    chunk->canary_start = CANARY_VALUE;
+    chunk->canary_end = CANARY_VALUE;
+    chunk->next = 0;
+    chunk->prev = 0;
+    chunk->flags = flags;
+}
+
+static void shm_insert(struct msm_shm_heap *heap, struct shm_chunk *chunk) {
+    uint64_t offset = shm_offset_of(heap, chunk);
+    chunk->prev = 0;
+    chunk->next = heap->free_list;
+    if (heap->free_list != 0) {
+        shm_chunk_at(heap, heap->free_list)->prev = offset;
+    }
+    heap->free_list = offset;
+}
+
+static void shm_remove(struct msm_shm_heap *heap, struct shm_chunk *chunk) {
+    if (chunk->prev != 0) {
+        shm_chunk_at(heap, chunk->prev)->next = chunk->next;
+    } else {
+        heap->free_list = chunk->next;
+    }
+    if (chunk->next != 0) {
+        shm_chunk_at(heap, chunk->next)->prev = chunk->prev;
+    }
+    chunk->next = 0;
+    chunk->prev = 0;
+}
+
+/**
+ * @brief Rebuilds the free list and the physical back links from a walk of the chunks.
+ *
+ * @return 1 if every chunk header is intact, 0 if the walk met a corrupted one.
+ *
+ * The caller must hold the heap lock. Adjacent free chunks are merged on the
+ * way. Chunks a dead process was allocating stay BUSY and are lost, but the
+ * heap is consistent again. A heap whose walk fails is marked broken and
+ * refuses further allocations.
+ */
+int shm_recover(struct msm_shm_heap *heap) {
+    uint64_t prev = 0;
+    struct shm_chunk *last_free = NULL;
+
+    heap->free_list = 0;
+    heap->recoveries++;
+    for (uint64_t offset = SHM_HEADER_SIZE; offset + SHM_CHUNK_SIZE <= heap->size;) {
+        struct shm_chunk *chunk = shm_chunk_at(heap, offset);
+        if (!shm_chunk_valid(chunk) || chunk->size > heap->size - offset - SHM_CHUNK_SIZE) {
+            log_execution_report(1, "shm_recover: corrupted chunk", (size_t)offset, chunk);
+            heap->broken = 1;
+            return 0;
+        }
+        if (chunk->flags == FREE && last_free != NULL) {
+            last_free->size += SHM_CHUNK_SIZE + chunk->size;
+        } else {
+            chunk->prev_phys = prev;
+            if (chunk->flags == FREE) {
+                shm_insert(heap, chunk);
+                last_free = chunk;
+            } else {
+                last_free = NULL;
+            }
+            prev = offset;
+        }
+        offset += SHM_CHUNK_SIZE + chunk->size;
+    }
+    log_execution_report(2, "shm_recover: free list rebuilt", (size_t)heap->size, heap);
+    return 1;
+}
+
+/**
+ * @brief Takes the heap lock, repairing the heap if its previous holder died.
+ *
+ * @return 1 with the lock held, 0 with errno set if the heap is unusable.
+ */
+static int shm_lock(struct msm_shm_heap *heap) {
+    int rc = pthread_mutex_lock(&heap->lock);
+    if (rc == EOWNERDEAD) {
+        log_execution_report(1, "shm_lock: previous holder died, recovering", 0, heap);
+        shm_recover(heap);
+        pthread_mutex_consistent(&heap->lock);
+    } else if (rc != 0) {
+        errno = rc;
+        return 0;
+    }
+    if (heap->broken) {
+        pthread_mutex_unlock(&heap->lock);
+        errno = EIO;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Initialises the process-shared robust mutex of a heap.
+ */
+void shm_init_lock(struct msm_shm_heap *heap) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&heap->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/**
+ * @brief Writes an empty heap over a mapping.
+ *
+ * @param heap Start of the mapping (input).
+ * @param size Length of the mapping (input).
+ *
+ * The magic number is written last, so a heap interrupted while being
+ * formatted is never taken for a valid one.
+ */
+void shm_format(struct msm_shm_heap *heap, size_t size) {
+    memset(heap, 0, SHM_HEADER_SIZE);
+    heap->version = SHM_VERSION;
+    heap->size = size;
+    heap->base = (uint64_t)(uintptr_t)heap;
+    shm_init_lock(heap);
+
+    struct shm_chunk *first = shm_chunk_at(heap, SHM_HEADER_SIZE);
+    shm_set_chunk(first, size - SHM_HEADER_SIZE - SHM_CHUNK_SIZE, 0, FREE);
+    shm_insert(heap, first);
+    __atomic_store_n(&heap->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Tells whether a mapping holds a heap of this layout version and of the given size.
+ */
+int shm_header_valid(struct msm_shm_heap *heap, size_t size) {
+    return __atomic_load_n(&heap->magic, __ATOMIC_ACQUIRE) == SHM_MAGIC && heap->version == SHM_VERSION
+           && heap->size == (uint64_t)size;
+}
+
+/**
+ * @brief Returns the smallest size a heap can be formatted with.
+ */
+size_t shm_min_size(void) {
+    return SHM_HEADER_SIZE + SHM_CHUNK_SIZE + SHM_MIN_SIZE;
+}
+
+/**
+ * @brief Formats a shared heap in a file descriptor.
+ *
+ * @param fd Descriptor of a file, shared memory object or memfd, opened read-write (input).
+ * @param size Size of the heap in bytes, headers included (input).
+ * @return The heap mapped in the calling process, or NULL with errno set.
+ *
+ * The file is resized to size and any previous content is discarded. The
+ * descriptor may be closed once the heap is mapped.
+ */
+struct msm_shm_heap *msm_shm_create(int fd, size_t size) {
+    size = size & ~(size_t)(PAGE_SIZE - 1);
+    if (size < shm_min_size()) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        return NULL;
+    }
+    struct msm_shm_heap *heap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (heap == MAP_FAILED) {
+        log_execution_report(1, "msm_shm_create error: mmap failed", size, NULL);
+        return NULL;
+    }
+    shm_format(heap, size);
+    log_execution_report(2, "msm_shm_create", size, heap);
+    return heap;
+}
+
+/**
+ * @brief Maps a shared heap created by msm_shm_create, possibly by another process.
+ *
+ * @param fd Descriptor of the heap's file, opened read-write (input).
+ * @return The heap mapped in the calling process, or NULL with errno set to
+ * EINVAL when the file does not hold a heap.
+ */
+struct msm_shm_heap *msm_shm_attach(int fd) {
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        return NULL;
+    }
+    if ((size_t)st.st_size < shm_min_size()) {
+        errno = EINVAL;
+        return NULL;
+    }
+    struct msm_shm_heap *heap = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (heap == MAP_FAILED) {
+        return NULL;
+    }
+    if (!shm_header_valid(heap, (size_t)st.st_size)) {
+        munmap(heap, (size_t)st.st_size);
+        log_execution_report(1, "msm_shm_attach error: not a shared heap", (size_t)st.st_size, NULL);
+        errno = EINVAL;
+        return NULL;
+    }
+    log_execution_report(2, "msm_shm_attach", (size_t)heap->size, heap);
+    return heap;
+}
+
+/**
+ * @brief Unmaps a shared heap from the calling process. The heap itself is kept.
+ *
+ * @param heap Heap returned by msm_shm_create or msm_shm_attach (input).
+ */
+void msm_shm_detach(struct msm_shm_heap *heap) {
+    if (heap != NULL) {
+        munmap(heap, (size_t)heap->size);
+    }
+}
+
+/**
+ * @brief Allocates from a shared heap.
+ *
+ * @param heap Heap to allocate from (input).
+ * @param size Size of the memory to allocate (input).
+ * @return Pointer valid in the calling process, or NULL with errno set to
+ * ENOMEM when no free chunk is large enough.
+ */
+void *msm_shm_malloc(struct msm_shm_heap *heap, size_t size) {
+    if (size == 0 || size > heap->size) {
+        return NULL;
+    }
+    size = size < SHM_MIN_SIZE ? SHM_MIN_SIZE : shm_align(size);
+    if (!shm_lock(heap)) {
+        return NULL;
+    }
+    struct shm_chunk *chunk = shm_chunk_at(heap, heap->free_list);
+    while (chunk != NULL && chunk->size < size) {
+        chunk = shm_chunk_at(heap, chunk->next);
+    }
+    if (chunk == NULL) {
+        pthread_mutex_unlock(&heap->lock);
+        log_execution_report(1, "msm_shm_malloc: heap exhausted", size, heap);
+        errno = ENOMEM;
+        return NULL;
+    }
+    shm_remove(heap, chunk);
+    if (chunk->size >= size + SHM_CHUNK_SIZE + SHM_MIN_SIZE) {
+        uint64_t offset = shm_offset_of(heap, chunk);
+        struct shm_chunk *rest = shm_chunk_at(heap, offset + SHM_CHUNK_SIZE + size);
+        /* The remainder's header is complete before the chunk shrinks, so a
+         * physical walk never sees a half-split chunk. */
+        shm_set_chunk(rest, chunk->size - size - SHM_CHUNK_SIZE, offset, FREE);
+        chunk->size = size;
+        struct shm_chunk *after = shm_next_phys(heap, rest);
+        if (after != NULL) {
+            after->prev_phys = shm_offset_of(heap, rest);
+        }
+        shm_insert(heap, rest);
+    }
+    chunk->flags = BUSY;
+    pthread_mutex_unlock(&heap->lock);
+    log_execution_report(2, "msm_shm_malloc", (size_t)chunk->size, chunk + 1);
+    return chunk + 1;
+}
+
+/**
+ * @brief Returns a chunk to a shared heap, whichever process allocated it.
+ *
+ * @param heap Heap the chunk comes from (input).
+ * @param ptr Pointer returned by msm_shm_malloc or msm_shm_pointer (input).
+ *
+ * The chunk is merged with its free physical neighbours. Pointers outside the
+ * heap, corrupted headers and double frees are reported and ignored.
+ */
+void msm_shm_free(struct msm_shm_heap *heap, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (msm_shm_offset(heap, ptr) == 0) {
+        log_execution_report(1, "msm_shm_free error: pointer outside the heap", 0, ptr);
+        return;
+    }
+    struct shm_chunk *chunk = (struct shm_chunk *)ptr - 1;
+    if (!shm_lock(heap)) {
+        return;
+    }
+    if (!shm_chunk_valid(chunk) || chunk->flags != BUSY) {
+        pthread_mutex_unlock(&heap->lock);
+        log_execution_report(1, "msm_shm_free error: Invalid free, double free or corrupted memory", 0, ptr);
+        return;
+    }
+    chunk->flags = FREE;
+    struct shm_chunk *next = shm_next_phys(heap, chunk);
+    if (next != NULL && next->flags == FREE && shm_chunk_valid(next)) {
+        shm_remove(heap, next);
+        chunk->size += SHM_CHUNK_SIZE + next->size;
+    }
+    struct shm_chunk *prev = shm_chunk_at(heap, chunk->prev_phys);
+    if (prev != NULL && prev->flags == FREE && shm_chunk_valid(prev)) {
+        shm_remove(heap, prev);
+        prev->size += SHM_CHUNK_SIZE + chunk->size;
+        chunk = prev;
+    }
+    next = shm_next_phys(heap, chunk);
+    if (next != NULL) {
+        next->prev_phys = shm_offset_of(heap, chunk);
+    }
+    shm_insert(heap, chunk);
+    pthread_mutex_unlock(&heap->lock);
+    log_execution_report(2, "msm_shm_free", (size_t)chunk->size, ptr);
+}
+
+/**
+ * @brief Converts a pointer into a shared heap to an offset any process can use.
+ *
+ * @param heap Heap the pointer belongs to (input).
+ * @param ptr Pointer into the heap (input).
+ * @return Offset from the start of the heap, or 0 when ptr is not in its chunk area.
+ */
+uint64_t msm_shm_offset(struct msm_shm_heap *heap, void *ptr) {
+    char *start = (char *)heap + SHM_HEADER_SIZE + SHM_CHUNK_SIZE;
+    char *end = (char *)heap + heap->size;
+    if ((char *)ptr < start || (char *)ptr >= end) {
+        return 0;
+    }
+    return (uint64_t)((char *)ptr - (char *)heap);
+}
+
+/**
+ * @brief Converts an offset from msm_shm_offset back to a pointer in the calling process.
+ *
+ * @param heap Heap the offset belongs to (input).
+ * @param offset Offset returned by msm_shm_offset, in any process (input).
+ * @return Pointer into the heap, or NULL when the offset is out of range.
+ */
+void *msm_shm_pointer(struct msm_shm_heap *heap, uint64_t offset) {
+    if (offset < SHM_HEADER_SIZE + SHM_CHUNK_SIZE || offset >= heap->size) {
+        return NULL;
+    }
+    return (char *)heap + offset;
+}
+
+/**
+ * @brief Finds the root slot holding a name.
+ *
+ * @return The slot, or NULL when no root has that name.
+ */
+static struct shm_root *shm_find_root(struct msm_shm_heap *heap, const char *name) {
+    for (int i = 0; i < MSM_SHM_ROOTS; i++) {
+        if (heap->roots[i].offset != 0 && strncmp(heap->roots[i].name, name, MSM_SHM_ROOT_NAME) == 0) {
+            return &heap->roots[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Registers an object of a heap under a name, so it can be found again after attaching.
+ *
+ * @param heap Heap holding the object (input).
+ * @param name Name of the root, shorter than MSM_SHM_ROOT_NAME (input).
+ * @param ptr Object to register, or NULL to remove the root (input).
+ * @return 0, or -1 with errno set to ENAMETOOLONG, EINVAL when ptr is not in
+ * the heap, or ENOSPC when every root slot is taken.
+ */
+int msm_shm_set_root(struct msm_shm_heap *heap, const char *name, void *ptr) {
+    uint64_t offset = 0;
+
+    if (strlen(name) >= MSM_SHM_ROOT_NAME) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (ptr != NULL && (offset = msm_shm_offset(heap, ptr)) == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!shm_lock(heap)) {
+        return -1;
+    }
+    struct shm_root *root = shm_find_root(heap, name);
+    if (root == NULL && offset != 0) {
+        for (int i = 0; i < MSM_SHM_ROOTS && root == NULL; i++) {
+            if (heap->roots[i].offset == 0) {
+                root = &heap->roots[i];
+                strncpy(root->name, name, MSM_SHM_ROOT_NAME);
+            }
+        }
+        if (root == NULL) {
+            pthread_mutex_unlock(&heap->lock);
+            errno = ENOSPC;
+            return -1;
+        }
+    }
+    if (root != NULL) {
+        __atomic_store_n(&root->offset, offset, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&heap->lock);
+    return 0;
+}
+
+/**
+ * @brief Returns the object registered under a name.
+ *
+ * @param heap Heap to look in (input).
+ * @param name Name given to msm_shm_set_root (input).
+ * @return Pointer valid in the calling process, or NULL when there is no such root.
+ */
+void *msm_shm_get_root(struct msm_shm_heap *heap, const char *name) {
+    if (!shm_lock(heap)) {
+        return NULL;
+    }
+    struct shm_root *root = shm_find_root(heap, name);
+    void *ptr = root != NULL ? msm_shm_pointer(heap, root->offset) : NULL;
+    pthread_mutex_unlock(&heap->lock);
+    return ptr;
+}
@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/auxv.h>
+#include <string.h>
+#include <unistd.h>
+#include "my_secmalloc.private.h"
+
+/*
+ * Size-class slabs for small allocations.
+ *
+ * Every size class owns a fixed slice of one reserved region, carved into
+ * one-page slabs of equally sized slots. A slot is a struct chunk header
+ * followed by the class size, so my_free and my_realloc validate it like
+ * any other chunk. Slab metadata (the free-slot bitmap) lives out of line in
+ * a separate mapping, out of reach of overflows from the slots themselves.
+ *
+ * A class allocates from its current slab until it is full, which keeps
+ * objects of a class packed in few pages. Inside the slab the slot is
+ * picked by starting the bitmap scan at a random position, so the address
+ * returned by the next allocation cannot be predicted from the previous one.
+ */
+
+#define SLAB_CLASS_COUNT 12
+#define SLAB_CLASS_REGION ((size_t)64 * 1024 * 1024)
+#define SLABS_PER_CLASS (SLAB_CLASS_REGION / PAGE_SIZE)
+#define SLAB_NONE UINT32_MAX
+
+/**
+ * @brief Out-of-line metadata of one slab.
+ */
+struct slab_meta {
+    uint64_t free_map;      /**< Bit i set when slot i is free. */
+    uint32_t next_partial;  /**< Next slab of the class with free slots, or SLAB_NONE. */
+    uint16_t free_count;    /**< Number of free slots. */
+    uint16_t listed;        /**< 1 while the slab is on the partial list or current. */
+};
+
+/**
+ * @brief State of one size class.
+ */
+struct slab_class {
+    size_t size;            /**< Usable size of a slot. */
+    size_t stride;          /**< Distance between two slots, header included. */
+    uint32_t slots;         /**< Slots per slab. */
+    uint32_t current;       /**< Slab allocations are served from, or SLAB_NONE. */
+    uint32_t partial;       /**< Head of the list of other slabs with free slots. */
+    uint32_t used;          /**< Slabs carved so far. */
+};
+
+static const size_t class_sizes[SLAB_CLASS_COUNT] = { 16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256 };
+static struct slab_class classes[SLAB_CLASS_COUNT];
+static struct slab_meta *slab_metas = NULL;
+static char *slab_region = NULL;
+static uint64_t prng_seed = 0;
+static uint64_t prng_threads = 0;
+static __thread uint64_t prng_state = 0;
+
+/**
+ * @brief splitmix64 finaliser, used to derive per-thread seeds.
+ */
+static uint64_t mix64(uint64_t value) {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+/**
+ * @brief Seeds the calling thread's generator from the process seed.
+ */
+static void prng_seed_thread(void) {
+    uint64_t thread = __atomic_add_fetch(&prng_threads, 1, __ATOMIC_RELAXED);
+    prng_state = mix64(prng_seed ^ mix64(thread) ^ (uint64_t)(uintptr_t)&prng_state);
+    if (prng_state == 0) {
+        prng_state = 1;
+    }
+}
+
+#if MSM_RANDOM_SLOTS
+/**
+ * @brief Returns a number in [0, bound) from the per-thread wyrand generator.
+ */
+static uint32_t prng_below(uint32_t bound) {
+    if (prng_state == 0) {
+        prng_seed_thread();
+    }
+    prng_state += 0xa0761d6478bd642fULL;
+    __uint128_t product = (__uint128_t)prng_state * (prng_state ^ 0xe7037ed1a0b428dbULL);
+    uint64_t random = (uint64_t)(product >> 64) ^ (uint64_t)product;
+    return (uint32_t)(((random & 0xffffffffULL) * bound) >> 32);
+}
+#endif
+
+/**
+ * @brief Maps a request size to its size class.
+ */
+static int size_to_class(size_t size) {
+    if (size <= 128) {
+        return (int)((size + 15) / 16) - 1 + (size == 0);
+    }
+    return 8 + (int)((size - 129) / 32);
+}
+
+static struct slab_meta *meta_of(int cls, uint32_t slab) {
+    return &slab_metas[(size_t)cls * SLABS_PER_CLASS + slab];
+}
+
+static char *slab_page(int cls, uint32_t slab) {
+    return slab_region + (size_t)cls * SLAB_CLASS_REGION + (size_t)slab * PAGE_SIZE;
+}
+
+/**
+ * @brief Reserves the slab region and its metadata on first use.
+ *
+ * @return 1 on success, 0 if the reservation failed.
+ *
+ * Both mappings are MAP_NORESERVE: only the pages slabs actually use are
+ * backed by memory, and only those are counted against the memory limits.
+ */
+static int slab_init(void) {
+    size_t region = SLAB_CLASS_COUNT * SLAB_CLASS_REGION;
+    size_t metas = SLAB_CLASS_COUNT * SLABS_PER_CLASS * sizeof(struct slab_meta);
+
+    char *data = mmap(NULL, region, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED) {
+        log_execution_report(1, "slab_init: failed to reserve the slab region", region, NULL);
+        return 0;
+    }
+    slab_metas = mmap(NULL, metas, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (slab_metas == MAP_FAILED) {
+        munmap(data, region);
+        slab_metas = NULL;
+        log_execution_report(1, "slab_init: failed to reserve the slab metadata", metas, NULL);
+        return 0;
+    }
+    for (int cls = 0; cls < SLAB_CLASS_COUNT; cls++) {
+        classes[cls].size = class_sizes[cls];
+        classes[cls].stride = CHUNK_SIZE + class_sizes[cls];
+        classes[cls].slots = (uint32_t)(PAGE_SIZE / classes[cls].stride);
+        if (classes[cls].slots > 64) {
+            classes[cls].slots = 64;
+        }
+        classes[cls].current = SLAB_NONE;
+        classes[cls].partial = SLAB_NONE;
+        classes[cls].used = 0;
+    }
+    unsigned char *random = (unsigned char *)getauxval(AT_RANDOM);
+    if (random != NULL) {
+        memcpy(&prng_seed, random, sizeof(prng_seed));
+    }
+    prng_seed ^= mix64((uint64_t)(uintptr_t)data ^ (uint64_t)getpid());
+    slab_region = data;
+    log_execution_report(2, "slab_init: reserved slab region", region, data);
+    return 1;
+}
+
+/**
+ * @brief Makes a slab with free slots the current one of its class.
+ *
+ * @return 1 on success, 0 when the class region is exhausted or the memory
+ * limits refuse a new page.
+ */
+static int slab_refill(int cls) {
+    struct slab_class *sc = &classes[cls];
+    uint32_t slab = sc->partial;
+
+    if (slab != SLAB_NONE) {
+        sc->partial = meta_of(cls, slab)->next_partial;
+    } else {
+        if (sc->used == SLABS_PER_CLASS || !limit_reserve(PAGE_SIZE)) {
+            return 0;
+        }
+        slab = sc->used;
+        if (!pagemap_set(slab_page(cls, slab), PAGE_SIZE, PAGE_SLAB, cls, 0)) {
+            limit_release(PAGE_SIZE);
+            return 0;
+        }
+        sc->used++;
+        struct slab_meta *meta = meta_of(cls, slab);
+        meta->free_map = sc->slots == 64 ? ~0ULL : (1ULL << sc->slots) - 1;
+        meta->free_count = (uint16_t)sc->slots;
+    }
+    meta_of(cls, slab)->listed = 1;
+    sc->current = slab;
+    return 1;
+}
+
+/**
+ * @brief Allocates a slot for a small request.
+ *
+ * @param size Requested size, at most SLAB_MAX_SIZE (input).
+ * @return Pointer to the slot's data, or NULL to fall back to the chunk allocator.
+ *
+ * The caller must hold the heap lock.
+ */
+void *slab_malloc(size_t size) {
+    if (slab_region == NULL && !slab_init()) {
+        return NULL;
+    }
+    int cls = size_to_class(size);
+    struct slab_class *sc = &classes[cls];
+    if (sc->current == SLAB_NONE && !slab_refill(cls)) {
+        return NULL;
+    }
+    struct slab_meta *meta = meta_of(cls, sc->current);
+#if MSM_RANDOM_SLOTS
+    uint32_t start = prng_below(sc->slots);
+    uint64_t candidates = meta->free_map & (~0ULL << start);
+    if (candidates == 0) {
+        candidates = meta->free_map;
+    }
+#else
+    uint64_t candidates = meta->free_map;
+#endif
+    int slot = __builtin_ctzll(candidates);
+    meta->free_map &= ~(1ULL << slot);
+    struct chunk *chunk = (struct chunk *)(slab_page(cls, sc->current) + (size_t)slot * sc->stride);
+    if (--meta->free_count == 0) {
+        meta->listed = 0;
+        sc->current = SLAB_NONE;
+    }
+    chunk->size = sc->size;
+    chunk->canary_start = CANARY_VALUE;
+    chunk->canary_end = CANARY_VALUE;
+    chunk->next = NULL;
+    chunk->prev = NULL;
+    chunk->flags = BUSY;
+    log_execution_report(2, "slab_malloc", sc->size, chunk + 1);
+    return chunk + 1;
+}
+
+/**
+ * @brief Releases a slot.
+ *
+ * @param ptr Pointer into a page the page map records as PAGE_SLAB (input).
+ *
+ * The caller must hold the heap lock. The slot index is derived from the
+ * address alone; pointers that do not start a slot, double frees and
+ * corrupted headers are reported and ignored.
+ */
+void slab_free(void *ptr) {
+    size_t offset = (size_t)((char *)ptr - slab_region);
+    int cls = (int)(offset / SLAB_CLASS_REGION);
+    struct slab_class *sc = &classes[cls];
+    uint32_t slab = (uint32_t)((offset % SLAB_CLASS_REGION) / PAGE_SIZE);
+    size_t in_page = offset % PAGE_SIZE;
+    uint32_t slot = (uint32_t)(in_page / sc->stride);
+    struct chunk *chunk = (struct chunk *)ptr - 1;
+
+    if (slab >= sc->used || slot >= sc->slots || in_page != slot * sc->stride + CHUNK_SIZE) {
+        log_execution_report(1, "slab_free error: Invalid free: not a slot", 0, ptr);
+        return;
+    }
+    HIST_SIZE(sc->size);
+    struct slab_meta *meta = meta_of(cls, slab);
+    if (meta->free_map & (1ULL << slot)) {
+        log_execution_report(1, "my_free error: Invalid free: Double free detected", sc->size, chunk);
+        return;
+    }
+#if MSM_CHECKS
+    if (chunk->canary_start != CANARY_VALUE || chunk->canary_end != CANARY_VALUE) {
+        log_execution_report(1, "my_free error: Invalid free or corrupted memory", chunk->size, chunk);
+        return;
+    }
+#endif
+    chunk->flags = FREE;
+    meta->free_map |= 1ULL << slot;
+    meta->free_count++;
+    if (!meta->listed) {
+        meta->listed = 1;
+        meta->next_partial = sc->partial;
+        sc->partial = slab;
+    }
+    log_execution_report(2, "slab_free", sc->size, ptr);
+}
+
+/**
+ * @brief Returns the usable size of the slots of a size class.
+ */
+size_t slab_class_size(int size_class) {
+    return class_sizes[size_class];
+}
+
+/**
+ * @brief Gives the surviving thread of a forked child a fresh random sequence.
+ *
+ * Without it parent and child would hand out slots in the same order.
+ */
+void slab_atfork_child(void) {
+    prng_seed ^= mix64((uint64_t)getpid());
+    prng_seed_thread();
+}
+
+/**
+ * @brief Checks the headers of the busy slots of one slab page.
+ *
+ * @param page Slab page, recorded PAGE_SLAB in the page map (input).
+ * @param size_class Size class recorded for the page (input).
+ * @return The first busy slot with a corrupted header, or NULL.
+ *
+ * The caller must hold the heap lock.
+ */
+struct chunk *slab_check_page(char *page, int size_class) {
+    struct slab_class *sc = &classes[size_class];
+    uint32_t slab = (uint32_t)((size_t)(page - slab_region) % SLAB_CLASS_REGION / PAGE_SIZE);
+    uint64_t free_map = meta_of(size_class, slab)->free_map;
+
+    for (uint32_t slot = 0; slot < sc->slots; slot++) {
+        struct chunk *chunk = (struct chunk *)(page + (size_t)slot * sc->stride);
+        if ((free_map & (1ULL << slot)) == 0
+            && (chunk->canary_start != CANARY_VALUE || chunk->canary_end != CANARY_VALUE
+                || chunk->flags != BUSY || chunk->size != sc->size)) {
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Checks the bitmaps, partial lists and slot headers of every slab.
+ *
+ * @param pages Number of slab pages in use (output).
+ * @return Number of inconsistencies found, each reported with debug_print.
+ *
+ * The caller must hold the heap lock.
+ */
+int slab_check_invariants(size_t *pages) {
+    int errors = 0;
+
+    *pages = 0;
+    if (slab_region == NULL) {
+        return 0;
+    }
+    for (int cls = 0; cls < SLAB_CLASS_COUNT; cls++) {
+        struct slab_class *sc = &classes[cls];
+        uint64_t all = sc->slots == 64 ? ~0ULL : (1ULL << sc->slots) - 1;
+        uint32_t listed = 0;
+
+        *pages += sc->used;
+        for (uint32_t slab = 0; slab < sc->used; slab++) {
+            struct slab_meta *meta = meta_of(cls, slab);
+            struct page_info page = pagemap_lookup(slab_page(cls, slab));
+            if (page.kind != PAGE_SLAB || page.size_class != cls) {
+                debug_print(1, "slab %d/%u: wrong page map entry", cls, slab);
+                errors++;
+            }
+            if ((meta->free_map & ~all) != 0 || __builtin_popcountll(meta->free_map) != meta->free_count) {
+                debug_print(1, "slab %d/%u: bitmap and free count disagree", cls, slab);
+                errors++;
+            }
+            if (meta->free_count != 0 && !meta->listed) {
+                debug_print(1, "slab %d/%u: slab with free slots is unreachable", cls, slab);
+                errors++;
+            }
+            listed += meta->listed;
+            struct chunk *bad = slab_check_page(slab_page(cls, slab), cls);
+            if (bad != NULL) {
+                debug_print(1, "slab %d/%u: corrupted slot header at %p", cls, slab, (void *)bad);
+                errors++;
+            }
+        }
+        uint32_t reachable = sc->current != SLAB_NONE;
+        for (uint32_t slab = sc->partial; slab != SLAB_NONE && reachable <= sc->used; slab = meta_of(cls, slab)->next_partial) {
+            reachable++;
+        }
+        if (reachable != listed) {
+            debug_print(1, "slab class %d: %u slabs listed, %u reachable", cls, listed, reachable);
+            errors++;
+        }
+    }
+    return errors;
+}
@@ -0,0 +1,360 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "my_secmalloc.private.h"
+
+#if MSM_HISTOGRAMS
+
+/**
+ * @brief Histograms of one thread, linked on a global list that is never shrunk.
+ *
+ * When a thread exits its histograms are orphaned rather than unmapped, so the
+ * counts stay visible to msm_histograms_collect() and the next new thread
+ * adopts them.
+ */
+struct thread_histograms {
+    struct msm_histograms hist;          /**< Counters, written by the owner only. */
+    int owned;                           /**< 1 while a live thread records into it. */
+    struct thread_histograms *next;      /**< Next entry of the global list. */
+};
+
+int hist_enabled = 0;
+__thread int hist_path = MSM_PATH_CACHE;
+__thread size_t hist_size = 0;
+__thread int hist_depth = 0;
+
+static struct thread_histograms *all_histograms = NULL;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct thread_histograms *thread_histograms = NULL;
+static pthread_key_t histograms_key;
+static int histograms_initialized = 0;
+static int exit_fd = -1;
+
+static const char *op_names[MSM_OP_COUNT] = { "malloc", "free", "calloc", "realloc" };
+static const char *path_names[MSM_PATH_COUNT] = { "cache", "search", "map" };
+
+static int fls64(uint64_t value) {
+    return 63 - __builtin_clzll(value);
+}
+
+/**
+ * @brief Maps a latency to its log-linear bucket: four buckets per power of two.
+ */
+static int latency_bucket(uint64_t ticks) {
+    if (ticks < 4) {
+        return (int)ticks;
+    }
+    int exponent = fls64(ticks);
+    int bucket = (exponent - 1) * 4 + (int)((ticks >> (exponent - 2)) & 3);
+    return bucket < MSM_HIST_BUCKETS ? bucket : MSM_HIST_BUCKETS - 1;
+}
+
+/**
+ * @brief Maps a size to its power of two class, 16 bytes and below being class 0.
+ */
+static int size_class(size_t size) {
+    if (size <= 16) {
+        return 0;
+    }
+    int cls = fls64(size - 1) - 3;
+    return cls < MSM_HIST_SIZE_CLASSES ? cls : MSM_HIST_SIZE_CLASSES - 1;
+}
+
+/**
+ * @brief Returns the smallest latency, in ticks, counted by a bucket.
+ *
+ * @param bucket Bucket index (input).
+ */
+uint64_t msm_histogram_bucket_floor(int bucket) {
+    if (bucket < 4) {
+        return (uint64_t)bucket;
+    }
+    int exponent = bucket / 4 + 1;
+    return (uint64_t)(4 + bucket % 4) << (exponent - 2);
+}
+
+/**
+ * @brief Returns the largest size counted by a size class, 0 for the open-ended last one.
+ *
+ * @param size_class Size class index (input).
+ */
+size_t msm_histogram_size_class_limit(int size_class) {
+    if (size_class >= MSM_HIST_SIZE_CLASSES - 1) {
+        return 0;
+    }
+    return (size_t)16 << size_class;
+}
+
+/**
+ * @brief pthread key destructor: hands the exiting thread's histograms to the next thread.
+ */
+static void orphan_histograms(void *arg) {
+    struct thread_histograms *histograms = arg;
+    __atomic_store_n(&histograms->owned, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Returns the calling thread's histograms, adopting or mapping them on first use.
+ *
+ * @return The histograms, or NULL if they cannot be mapped.
+ *
+ * Histograms are mapped directly so that recording never re-enters malloc.
+ * Adoption and registration are serialised by the registry lock; readers walk
+ * the list without it.
+ */
+static struct thread_histograms *get_thread_histograms(void) {
+    if (thread_histograms != NULL) {
+        return thread_histograms;
+    }
+    pthread_mutex_lock(&registry_lock);
+    struct thread_histograms *histograms = all_histograms;
+    for (; histograms != NULL; histograms = histograms->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&histograms->owned, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (histograms == NULL) {
+        histograms = mmap(NULL, sizeof(*histograms), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (histograms == MAP_FAILED) {
+            pthread_mutex_unlock(&registry_lock);
+            return NULL;
+        }
+        histograms->owned = 1;
+        histograms->next = all_histograms;
+        __atomic_store_n(&all_histograms, histograms, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&registry_lock);
+    thread_histograms = histograms;
+    pthread_setspecific(histograms_key, histograms);
+    return histograms;
+}
+
+/**
+ * @brief Records one operation.
+ *
+ * @param op Operation being measured (input).
+ * @param size Size requested by, or released by, the operation (input).
+ * @param start Value returned by hist_begin() (input).
+ *
+ * The path comes from hist_path, set by the allocator while serving the call.
+ */
+void hist_record(enum msm_hist_op op, size_t size, uint64_t start) {
+    uint64_t ticks = hist_now() - start;
+    hist_depth = 0;
+    struct thread_histograms *histograms = get_thread_histograms();
+    if (histograms == NULL) {
+        return;
+    }
+    histograms->hist.count[op][hist_path][size_class(size)][latency_bucket(ticks)]++;
+}
+
+/**
+ * @brief Reads the "MSM_HISTOGRAMS" environment variable once.
+ *
+ * "1" enables recording and dumps the histograms to stderr at exit, any other
+ * value except "0" is taken as the file the exit dump is written to.
+ */
+void histograms_init(void) {
+    if (histograms_initialized) {
+        return;
+    }
+    histograms_initialized = 1;
+    pthread_key_create(&histograms_key, orphan_histograms);
+    char *setting = getenv("MSM_HISTOGRAMS");
+    if (setting == NULL || strcmp(setting, "0") == 0) {
+        return;
+    }
+    if (strcmp(setting, "1") == 0) {
+        exit_fd = STDERR_FILENO;
+    } else {
+        exit_fd = open(setting, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    hist_enabled = 1;
+}
+
+/**
+ * @brief Takes the registry lock before fork(), so no thread is registering.
+ */
+void histograms_atfork_prepare(void) {
+    pthread_mutex_lock(&registry_lock);
+}
+
+/**
+ * @brief Releases the registry lock in the parent after fork().
+ */
+void histograms_atfork_parent(void) {
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * @brief Resets the registry lock and orphans the histograms of the threads
+ * that did not survive fork().
+ */
+void histograms_atfork_child(void) {
+    pthread_mutex_init(&registry_lock, NULL);
+    struct thread_histograms *histograms = all_histograms;
+    for (; histograms != NULL; histograms = histograms->next) {
+        if (histograms != thread_histograms) {
+            histograms->owned = 0;
+        }
+    }
+}
+
+/**
+ * @brief Turns recording on or off at runtime.
+ *
+ * @param enabled Non-zero to record (input).
+ * @return 0, or -1 when histograms are not compiled into this profile.
+ */
+int msm_histograms_enable(int enabled) {
+    HEAP_LOCK();
+    histograms_init();
+    HEAP_UNLOCK();
+    hist_enabled = enabled != 0;
+    return 0;
+}
+
+/**
+ * @brief Sums the histograms of every thread, live or exited.
+ *
+ * @param out Destination of the merged counters (output).
+ * @return 0, or -1 when histograms are not compiled into this profile.
+ *
+ * Counters of running threads are read without synchronisation and may be
+ * a few operations behind.
+ */
+int msm_histograms_collect(struct msm_histograms *out) {
+    uint64_t *dst = &out->count[0][0][0][0];
+    size_t total = sizeof(out->count) / sizeof(uint64_t);
+
+    memset(out, 0, sizeof(*out));
+    struct thread_histograms *histograms = __atomic_load_n(&all_histograms, __ATOMIC_ACQUIRE);
+    for (; histograms != NULL; histograms = histograms->next) {
+        const uint64_t *src = &histograms->hist.count[0][0][0][0];
+        for (size_t i = 0; i < total; i++) {
+            dst[i] += src[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the floor of the bucket holding a given quantile.
+ */
+static uint64_t quantile(const uint64_t *buckets, uint64_t count, uint64_t per_mille) {
+    uint64_t rank = (count * per_mille + 999) / 1000;
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < MSM_HIST_BUCKETS; bucket++) {
+        seen += buckets[bucket];
+        if (seen >= rank && buckets[bucket] != 0) {
+            return msm_histogram_bucket_floor(bucket);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the merged histograms as text.
+ *
+ * @param fd File descriptor to write to (input).
+ *
+ * One line per operation, path and size class that saw traffic, with the
+ * count, p50, p99, p99.9 and max bucket floors in ticks, followed by the
+ * non-empty buckets as floor:count pairs. The buffer lives on its own
+ * mapping so dumping never calls malloc.
+ */
+void msm_histograms_dump(int fd) {
+    struct msm_histograms *merged = mmap(NULL, sizeof(*merged), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char line[4096];
+
+    if (merged == MAP_FAILED) {
+        return;
+    }
+    msm_histograms_collect(merged);
+    int len = snprintf(line, sizeof(line), "# my_secmalloc latency histograms (%s profile, ticks)\n", MSM_PROFILE_NAME);
+    write(fd, line, (size_t)len);
+    for (int op = 0; op < MSM_OP_COUNT; op++) {
+        for (int path = 0; path < MSM_PATH_COUNT; path++) {
+            for (int cls = 0; cls < MSM_HIST_SIZE_CLASSES; cls++) {
+                const uint64_t *buckets = merged->count[op][path][cls];
+                uint64_t count = 0;
+                int max = 0;
+                for (int bucket = 0; bucket < MSM_HIST_BUCKETS; bucket++) {
+                    count += buckets[bucket];
+                    if (buckets[bucket] != 0) {
+                        max = bucket;
+                    }
+                }
+                if (count == 0) {
+                    continue;
+                }
+                size_t limit = msm_histogram_size_class_limit(cls);
+                char size_range[32];
+                if (limit != 0) {
+                    snprintf(size_range, sizeof(size_range), "size<=%zu", limit);
+                } else {
+                    snprintf(size_range, sizeof(size_range), "size>%zu", msm_histogram_size_class_limit(cls - 1));
+                }
+                len = snprintf(line, sizeof(line), "%s %s %s count=%llu p50=%llu p99=%llu p999=%llu max=%llu buckets=",
+                               op_names[op], path_names[path], size_range, (unsigned long long)count,
+                               (unsigned long long)quantile(buckets, count, 500),
+                               (unsigned long long)quantile(buckets, count, 990),
+                               (unsigned long long)quantile(buckets, count, 999),
+                               (unsigned long long)msm_histogram_bucket_floor(max));
+                for (int bucket = 0; bucket < MSM_HIST_BUCKETS && len < (int)sizeof(line) - 48; bucket++) {
+                    if (buckets[bucket] != 0) {
+                        len += snprintf(line + len, sizeof(line) - (size_t)len, "%llu:%llu,",
+                                        (unsigned long long)msm_histogram_bucket_floor(bucket),
+                                        (unsigned long long)buckets[bucket]);
+                    }
+                }
+                line[len - 1] = '\n';
+                write(fd, line, (size_t)len);
+            }
+        }
+    }
+    munmap(merged, sizeof(*merged));
+}
+
+/**
+ * @brief Dumps the histograms at exit when MSM_HISTOGRAMS asked for it.
+ */
+__attribute__((destructor))
+static void histograms_exit_dump(void) {
+    if (hist_enabled && exit_fd >= 0) {
+        msm_histograms_dump(exit_fd);
+    }
+}
+
+#else
+
+int msm_histograms_enable(int enabled) {
+    (void)enabled;
+    return -1;
+}
+
+int msm_histograms_collect(struct msm_histograms *out) {
+    memset(out, 0, sizeof(*out));
+    return -1;
+}
+
+void msm_histograms_dump(int fd) {
+    (void)fd;
+}
+
+uint64_t msm_histogram_bucket_floor(int bucket) {
+    (void)bucket;
+    return 0;
+}
+
+size_t msm_histogram_size_class_limit(int size_class) {
+    (void)size_class;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,435 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+#include "my_secmalloc.private.h"
+
+/*
+ * Bounded-latency pools, after the two-level segregated fit (TLSF) allocator.
+ *
+ * Free blocks are kept in FL_COUNT x SL_COUNT segregated lists. The first
+ * level splits sizes by power of two, the second level splits each power of
+ * two into SL_COUNT linear ranges. Two bitmaps record which lists are not
+ * empty, so finding a fitting block is two bit scans. Splitting and merging
+ * touch at most three blocks. No operation depends on the number of blocks
+ * in the pool, and a pool never maps memory after it has been created.
+ */
+
+#define RT_ALIGN_LOG2 4
+#define RT_ALIGN ((size_t)1 << RT_ALIGN_LOG2)
+#define RT_SL_LOG2 4
+#define RT_SL_COUNT (1 << RT_SL_LOG2)
+#define RT_FL_SHIFT (RT_SL_LOG2 + RT_ALIGN_LOG2)
+#define RT_FL_MAX 32
+#define RT_FL_COUNT (RT_FL_MAX - RT_FL_SHIFT + 1)
+#define RT_SMALL_BLOCK ((size_t)1 << RT_FL_SHIFT)
+#define RT_BLOCK_SIZE sizeof(struct rt_block)
+#define RT_MIN_SPLIT (RT_BLOCK_SIZE + RT_ALIGN)
+
+/**
+ * @brief Header of a block inside a bounded-latency pool.
+ */
+struct rt_block {
+    size_t size;                /**< Size of the block's data area. */
+    uint32_t canary_start;      /**< Canary value at the start of the block. */
+    uint32_t canary_end;        /**< Canary value at the end of the block. */
+    struct rt_block *prev_phys; /**< Physically preceding block, NULL for the first one. */
+    struct rt_block *next_free; /**< Next block in the segregated list (free blocks only). */
+    struct rt_block *prev_free; /**< Previous block in the segregated list (free blocks only). */
+    enum chunk_type flags;      /**< FREE or BUSY. */
+};
+
+/**
+ * @brief A bounded-latency pool, stored at the start of its own mapping.
+ */
+struct msm_rt_pool {
+    volatile char lock;                               /**< Spin lock for frees coming from other threads. */
+    char *start;                                      /**< First byte of the block area. */
+    char *end;                                        /**< One past the last byte of the block area. */
+    size_t mapped;                                    /**< Length of the mapping. */
+    size_t used;                                      /**< Bytes currently handed out. */
+    uint32_t fl_bitmap;                               /**< Non-empty first-level classes. */
+    uint32_t sl_bitmap[RT_FL_COUNT];                  /**< Non-empty second-level classes. */
+    struct rt_block *blocks[RT_FL_COUNT][RT_SL_COUNT];/**< Segregated free lists. */
+};
+
+static struct msm_rt_pool *rt_pools[MSM_RT_MAX_POOLS];
+int rt_pool_count = 0;
+__thread struct msm_rt_pool *rt_pinned_pool = NULL;
+
+static int fls_size(size_t value) {
+    return (int)(sizeof(size_t) * 8) - 1 - __builtin_clzl(value);
+}
+
+static size_t align_up(size_t value) {
+    return (value + RT_ALIGN - 1) & ~(RT_ALIGN - 1);
+}
+
+static void rt_lock(struct msm_rt_pool *pool) {
+    while (__atomic_test_and_set(&pool->lock, __ATOMIC_ACQUIRE)) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+static void rt_unlock(struct msm_rt_pool *pool) {
+    __atomic_clear(&pool->lock, __ATOMIC_RELEASE);
+}
+
+static struct rt_block *rt_next_phys(struct rt_block *block) {
+    return (struct rt_block *)((char *)(block + 1) + block->size);
+}
+
+/**
+ * @brief Computes the segregated list holding blocks of a given size.
+ */
+static void mapping_insert(size_t size, int *fl, int *sl) {
+    if (size < RT_SMALL_BLOCK) {
+        *fl = 0;
+        *sl = (int)(size / (RT_SMALL_BLOCK / RT_SL_COUNT));
+    } else {
+        int f = fls_size(size);
+        *sl = (int)(size >> (f - RT_SL_LOG2)) ^ RT_SL_COUNT;
+        *fl = f - (RT_FL_SHIFT - 1);
+    }
+}
+
+/**
+ * @brief Computes the first list whose blocks are all large enough for size.
+ */
+static void mapping_search(size_t size, int *fl, int *sl) {
+    if (size >= RT_SMALL_BLOCK) {
+        size += ((size_t)1 << (fls_size(size) - RT_SL_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+static void rt_insert(struct msm_rt_pool *pool, struct rt_block *block) {
+    int fl, sl;
+    mapping_insert(block->size, &fl, &sl);
+    block->flags = FREE;
+    block->prev_free = NULL;
+    block->next_free = pool->blocks[fl][sl];
+    if (block->next_free) {
+        block->next_free->prev_free = block;
+    }
+    pool->blocks[fl][sl] = block;
+    pool->fl_bitmap |= 1U << fl;
+    pool->sl_bitmap[fl] |= 1U << sl;
+}
+
+static void rt_remove(struct msm_rt_pool *pool, struct rt_block *block) {
+    int fl, sl;
+    mapping_insert(block->size, &fl, &sl);
+    if (block->prev_free) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        pool->blocks[fl][sl] = block->next_free;
+        if (pool->blocks[fl][sl] == NULL) {
+            pool->sl_bitmap[fl] &= ~(1U << sl);
+            if (pool->sl_bitmap[fl] == 0) {
+                pool->fl_bitmap &= ~(1U << fl);
+            }
+        }
+    }
+    if (block->next_free) {
+        block->next_free->prev_free = block->prev_free;
+    }
+}
+
+/**
+ * @brief Finds a free block of at least size bytes with two bit scans.
+ */
+static struct rt_block *rt_find(struct msm_rt_pool *pool, size_t size) {
+    int fl, sl;
+    mapping_search(size, &fl, &sl);
+    if (fl >= RT_FL_COUNT) {
+        return NULL;
+    }
+    uint32_t sl_map = pool->sl_bitmap[fl] & (~0U << sl);
+    if (sl_map == 0) {
+        uint32_t fl_map = fl + 1 < 32 ? pool->fl_bitmap & (~0U << (fl + 1)) : 0;
+        if (fl_map == 0) {
+            return NULL;
+        }
+        fl = __builtin_ctz(fl_map);
+        sl_map = pool->sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+    return pool->blocks[fl][sl];
+}
+
+/**
+ * @brief Writes a block header.
+ */
+static void rt_set_block(struct rt_block *block, size_t size, struct rt_block *prev_phys, enum chunk_type flags) {
+    block->size = size;
+    block->canary_start = CANARY_VALUE;
+    block->canary_end = CANARY_VALUE;
+    block->prev_phys = prev_phys;
+    block->next_free = NULL;
+    block->prev_free = NULL;
+    block->flags = flags;
+}
+
+/**
+ * @brief Splits the tail of a block into a new free block when it is large enough.
+ */
+static void rt_split(struct msm_rt_pool *pool, struct rt_block *block, size_t size) {
+    if (block->size < size + RT_MIN_SPLIT) {
+        return;
+    }
+    struct rt_block *rest = (struct rt_block *)((char *)(block + 1) + size);
+    rt_set_block(rest, block->size - size - RT_BLOCK_SIZE, block, FREE);
+    block->size = size;
+    rt_next_phys(rest)->prev_phys = rest;
+    rt_insert(pool, rest);
+}
+
+/**
+ * @brief Merges a free block with its free physical neighbours.
+ *
+ * @return The resulting block, which is not on any free list.
+ */
+static struct rt_block *rt_merge(struct msm_rt_pool *pool, struct rt_block *block) {
+    struct rt_block *next = rt_next_phys(block);
+    if (next->flags == FREE) {
+        rt_remove(pool, next);
+        block->size += RT_BLOCK_SIZE + next->size;
+        rt_next_phys(block)->prev_phys = block;
+    }
+    struct rt_block *prev = block->prev_phys;
+    if (prev != NULL && prev->flags == FREE) {
+        rt_remove(pool, prev);
+        prev->size += RT_BLOCK_SIZE + block->size;
+        rt_next_phys(prev)->prev_phys = prev;
+        block = prev;
+    }
+    return block;
+}
+
+/**
+ * @brief Creates a bounded-latency pool.
+ *
+ * @param size Number of bytes the pool must be able to hand out (input).
+ * @return The new pool, or NULL if it cannot be mapped.
+ *
+ * The whole pool is mapped and pre-faulted here, and locked in memory when
+ * RLIMIT_MEMLOCK allows it, so allocations from it never fault or call mmap.
+ */
+struct msm_rt_pool *msm_rt_pool_create(size_t size) {
+    size_t header = align_up(sizeof(struct msm_rt_pool));
+    size_t mapped = (header + size + 2 * RT_BLOCK_SIZE + PAGE_SIZE - 1) & ~((size_t)PAGE_SIZE - 1);
+
+    if (size == 0 || size >= ((size_t)1 << RT_FL_MAX)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    HEAP_LOCK();
+    register_fork_handlers();
+    if (rt_pool_count == MSM_RT_MAX_POOLS) {
+        HEAP_UNLOCK();
+        log_execution_report(1, "msm_rt_pool_create error: too many pools", size, NULL);
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (!limit_reserve(mapped)) {
+        HEAP_UNLOCK();
+        return NULL;
+    }
+    struct msm_rt_pool *pool = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (pool == MAP_FAILED) {
+        limit_release(mapped);
+        HEAP_UNLOCK();
+        log_execution_report(1, "msm_rt_pool_create error: mmap failed", size, NULL);
+        return NULL;
+    }
+    int index = 0;
+    while (rt_pools[index] != NULL) {
+        index++;
+    }
+    if (!pagemap_set(pool, mapped, PAGE_RT_POOL, 0, index)) {
+        munmap(pool, mapped);
+        limit_release(mapped);
+        HEAP_UNLOCK();
+        errno = ENOMEM;
+        return NULL;
+    }
+    mlock(pool, mapped);
+    memset(pool, 0, sizeof(*pool));
+    pool->mapped = mapped;
+    pool->start = (char *)pool + header;
+    pool->end = (char *)pool + mapped;
+
+    struct rt_block *first = (struct rt_block *)pool->start;
+    struct rt_block *sentinel = (struct rt_block *)(pool->end - RT_BLOCK_SIZE);
+    rt_set_block(first, (size_t)((char *)sentinel - (char *)(first + 1)), NULL, FREE);
+    rt_set_block(sentinel, 0, first, BUSY);
+    rt_insert(pool, first);
+
+    rt_pools[index] = pool;
+    rt_pool_count++;
+    HEAP_UNLOCK();
+    log_execution_report(2, "msm_rt_pool_create", size, pool);
+    return pool;
+}
+
+/**
+ * @brief Takes the lock of every pool before fork().
+ *
+ * Called by fork_prepare with the heap lock held, which keeps the pool table
+ * stable. rt_malloc and rt_free never take the heap lock, so the order is safe.
+ */
+void rt_atfork_prepare(void) {
+    for (int i = 0; i < MSM_RT_MAX_POOLS; i++) {
+        if (rt_pools[i] != NULL) {
+            rt_lock(rt_pools[i]);
+        }
+    }
+}
+
+/**
+ * @brief Releases the pool locks in the parent after fork().
+ */
+void rt_atfork_parent(void) {
+    for (int i = 0; i < MSM_RT_MAX_POOLS; i++) {
+        if (rt_pools[i] != NULL) {
+            rt_unlock(rt_pools[i]);
+        }
+    }
+}
+
+/**
+ * @brief Clears the pool locks inherited by the child.
+ */
+void rt_atfork_child(void) {
+    for (int i = 0; i < MSM_RT_MAX_POOLS; i++) {
+        if (rt_pools[i] != NULL) {
+            __atomic_clear(&rt_pools[i]->lock, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief Destroys a pool. Blocks still allocated from it become invalid.
+ *
+ * @param pool Pool returned by msm_rt_pool_create (input).
+ */
+void msm_rt_pool_destroy(struct msm_rt_pool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    if (rt_pinned_pool == pool) {
+        rt_pinned_pool = NULL;
+    }
+    HEAP_LOCK();
+    for (int i = 0; i < MSM_RT_MAX_POOLS; i++) {
+        if (rt_pools[i] == pool) {
+            rt_pools[i] = NULL;
+            rt_pool_count--;
+        }
+    }
+    pagemap_clear(pool, pool->mapped);
+    limit_release(pool->mapped);
+    HEAP_UNLOCK();
+    munmap(pool, pool->mapped);
+}
+
+/**
+ * @brief Routes every allocation of the calling thread to a pool.
+ *
+ * @param pool Pool to use, or NULL to return to the regular heap (input).
+ */
+void msm_rt_pin(struct msm_rt_pool *pool) {
+    rt_pinned_pool = pool;
+}
+
+/**
+ * @brief Finds the pool owning a pointer.
+ *
+ * @param ptr Pointer to look up (input).
+ * @return The owning pool, or NULL if ptr does not come from a pool.
+ *
+ * The page map names the pool; the pool header itself is not a block.
+ */
+struct msm_rt_pool *rt_pool_of(void *ptr) {
+    struct page_info page = pagemap_lookup(ptr);
+    if (page.kind != PAGE_RT_POOL) {
+        return NULL;
+    }
+    struct msm_rt_pool *pool = rt_pools[page.owner];
+    if (pool != NULL && (char *)ptr > pool->start && (char *)ptr < pool->end) {
+        return pool;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Allocates from a pool in constant time.
+ *
+ * @param pool Pool to allocate from (input).
+ * @param size Size of the memory to allocate (input).
+ * @return Pointer to the allocated memory, or NULL with errno set to ENOMEM
+ * when the pool has no block large enough.
+ */
+void *rt_malloc(struct msm_rt_pool *pool, size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    if (size >= ((size_t)1 << RT_FL_MAX)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size = align_up(size);
+    rt_lock(pool);
+    struct rt_block *block = rt_find(pool, size);
+    if (block == NULL) {
+        rt_unlock(pool);
+        log_execution_report(1, "rt_malloc error: pool exhausted", size, pool);
+        errno = ENOMEM;
+        return NULL;
+    }
+    rt_remove(pool, block);
+    rt_split(pool, block, size);
+    block->flags = BUSY;
+    pool->used += block->size;
+    rt_unlock(pool);
+    log_execution_report(2, "rt_malloc", block->size, block + 1);
+    return block + 1;
+}
+
+/**
+ * @brief Returns a block to its pool in constant time.
+ *
+ * @param pool Pool owning ptr (input).
+ * @param ptr Pointer returned by rt_malloc (input).
+ */
+void rt_free(struct msm_rt_pool *pool, void *ptr) {
+    struct rt_block *block = (struct rt_block *)ptr - 1;
+    rt_lock(pool);
+#if MSM_CHECKS
+    if (block->flags == FREE) {
+        rt_unlock(pool);
+        log_execution_report(1, "rt_free error: Invalid free: Double free detected", block->size, block);
+        return;
+    }
+    if (block->canary_start != CANARY_VALUE || block->canary_end != CANARY_VALUE) {
+        rt_unlock(pool);
+        log_execution_report(1, "rt_free error: Invalid free or corrupted memory", block->size, block);
+        return;
+    }
+#endif
+    pool->used -= block->size;
+    block->flags = FREE;
+    rt_insert(pool, rt_merge(pool, block));
+    rt_unlock(pool);
+    log_execution_report(2, "rt_free", 0, ptr);
+}
+
+/**
+ * @brief Returns the usable size of a pool block.
+ */
+size_t rt_usable_size(void *ptr) {
+    return ((struct rt_block *)ptr - 1)->size;
+}
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "my_secmalloc.private.h"
+
+// Multi-threaded stress harness for the allocator.
+//
+// Every thread runs a seeded random mix of my_malloc, msm_malloc_hint,
+// my_aligned_alloc, my_calloc, my_realloc and my_free, fills each block with
+// its own byte pattern and checks it is intact before the block is resized
+// or freed. Some blocks are handed to other threads through a mailbox so
+// frees also happen away from the allocating thread. Between phases all
+// threads are joined and the heap invariants are checked.
+//
+// usage: stress [threads] [operations per thread and phase] [phases] [seed]
+
+#define MAX_THREADS 64
+#define SLOTS 256
+#define MAILBOX 64
+
+struct block {
+    unsigned char *ptr;
+    size_t size;
+    unsigned char pattern;
+};
+
+struct worker {
+    int id;
+    int phase;
+    long ops;
+    struct block slots[SLOTS];
+};
+
+static uint64_t seed = 0x5eed5eed;
+static struct block mailbox[MAILBOX];
+static int mailbox_count = 0;
+static pthread_mutex_t mailbox_lock = PTHREAD_MUTEX_INITIALIZER;
+static long failures = 0;
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static void fail(const char *what, struct block *block) {
+    __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+    fprintf(stderr, "stress: %s (block %p, %zu bytes, pattern %#x)\n", what, (void *)block->ptr, block->size, block->pattern);
+}
+
+// Sizes mostly small, some page-sized, a few large.
+static size_t random_size(uint64_t *state) {
+    uint64_t r = next_random(state);
+    switch (r % 100 / 30) {
+        case 0:
+        case 1:
+            return 1 + (r >> 8) % SLAB_MAX_SIZE;
+        case 2:
+            return 1 + (r >> 8) % LARGE_THRESHOLD;
+        default:
+            return r % 10 == 0 ? LARGE_THRESHOLD + (r >> 8) % (1 << 20) : 1 + (r >> 8) % (16 * 1024);
+    }
+}
+
+static void fill(struct block *block, uint64_t *state) {
+    block->pattern = (unsigned char)(1 + next_random(state) % 255);
+    memset(block->ptr, block->pattern, block->size);
+}
+
+static void check(struct block *block, size_t length, const char *what) {
+    for (size_t i = 0; i < length; i++) {
+        if (block->ptr[i] != block->pattern) {
+            fail(what, block);
+            return;
+        }
+    }
+    if (msm_malloc_usable_size(block->ptr) < block->size) {
+        fail("usable size smaller than the request", block);
+    }
+}
+
+static void release(struct block *block) {
+    if (block->ptr != NULL) {
+        check(block, block->size, "pattern overwritten before free");
+        my_free(block->ptr);
+        block->ptr = NULL;
+    }
+}
+
+static void *run_worker(void *arg) {
+    struct worker *worker = arg;
+    uint64_t state = seed ^ ((uint64_t)(worker->id + 1) * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)worker->phase << 32);
+
+    for (long op = 0; op < worker->ops; op++) {
+        uint64_t r = next_random(&state);
+        struct block *block = &worker->slots[(r >> 16) % SLOTS];
+        int kind = (int)(r % 100);
+
+        if (kind < 35) {
+            release(block);
+            block->size = random_size(&state);
+            if (r % 4 == 0) {
+                block->ptr = msm_malloc_hint(block->size, (unsigned)(r >> 40) % 8);
+            } else if (r % 4 == 1 && r % 3 == 0) {
+                block->ptr = my_aligned_alloc((size_t)32 << (r >> 40) % 9, block->size);
+            } else {
+                block->ptr = my_malloc(block->size);
+            }
+            if (block->ptr == NULL) {
+                fail("my_malloc returned NULL", block);
+                continue;
+            }
+            fill(block, &state);
+        } else if (kind < 45) {
+            release(block);
+            size_t count = 1 + next_random(&state) % 16;
+            size_t size = random_size(&state) / count + 1;
+            block->size = count * size;
+            block->ptr = my_calloc(count, size);
+            block->pattern = 0;
+            if (block->ptr == NULL) {
+                fail("my_calloc returned NULL", block);
+                continue;
+            }
+            check(block, block->size, "my_calloc memory not zeroed");
+            fill(block, &state);
+        } else if (kind < 65) {
+            size_t size = random_size(&state);
+            if (block->ptr != NULL) {
+                check(block, block->size, "pattern overwritten before realloc");
+            }
+            unsigned char *ptr = my_realloc(block->ptr, size);
+            if (block->ptr == NULL) {
+                block->size = 0;
+            }
+            if (ptr == NULL) {
+                fail("my_realloc returned NULL", block);
+                continue;
+            }
+            size_t kept = block->size < size ? block->size : size;
+            block->ptr = ptr;
+            block->size = size;
+            check(block, kept, "my_realloc lost the contents");
+            fill(block, &state);
+        } else if (kind < 90) {
+            release(block);
+        } else if (kind < 95) {
+            if (block->ptr != NULL) {
+                pthread_mutex_lock(&mailbox_lock);
+                if (mailbox_count < MAILBOX) {
+                    mailbox[mailbox_count++] = *block;
+                    block->ptr = NULL;
+                }
+                pthread_mutex_unlock(&mailbox_lock);
+            }
+        } else {
+            struct block remote = { NULL, 0, 0 };
+            pthread_mutex_lock(&mailbox_lock);
+            if (mailbox_count > 0) {
+                remote = mailbox[--mailbox_count];
+            }
+            pthread_mutex_unlock(&mailbox_lock);
+            release(&remote);
+            if (r % 997 == 0) {
+                msm_purge();
+            }
+        }
+    }
+    return NULL;
+}
+
+static int check_heap(const char *when, int phase) {
+    int errors = heap_check_invariants();
+    printf("stress: %s %d: %s, %zu bytes mapped\n", when, phase, errors == 0 ? "heap consistent" : "HEAP INCONSISTENT", msm_mapped_bytes());
+    return errors;
+}
+
+int main(int argc, char **argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 8;
+    long ops = argc > 2 ? atol(argv[2]) : 20000;
+    int phases = argc > 3 ? atoi(argv[3]) : 4;
+    if (argc > 4) {
+        seed = strtoull(argv[4], NULL, 0);
+    }
+    if (threads < 1 || threads > MAX_THREADS) {
+        fprintf(stderr, "stress: between 1 and %d threads\n", MAX_THREADS);
+        return 2;
+    }
+    printf("stress: %d threads, %ld operations per phase, %d phases, seed %#llx\n",
+           threads, ops, phases, (unsigned long long)seed);
+
+    struct worker *workers = calloc((size_t)threads, sizeof(*workers));
+    pthread_t tids[MAX_THREADS];
+    int errors = 0;
+    for (int phase = 0; phase < phases; phase++) {
+        for (int i = 0; i < threads; i++) {
+            workers[i].id = i;
+            workers[i].phase = phase;
+            workers[i].ops = ops;
+            pthread_create(&tids[i], NULL, run_worker, &workers[i]);
+        }
+        for (int i = 0; i < threads; i++) {
+            pthread_join(tids[i], NULL);
+        }
+        errors += check_heap("phase", phase);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        for (int slot = 0; slot < SLOTS; slot++) {
+            release(&workers[i].slots[slot]);
+        }
+    }
+    while (mailbox_count > 0) {
+        release(&mailbox[--mailbox_count]);
+    }
+    msm_purge();
+    errors += check_heap("teardown", phases);
+    free(workers);
+
+    if (errors != 0 || failures != 0) {
+        printf("stress: FAILED, %d heap inconsistencies, %ld content errors\n", errors, failures);
+        return 1;
+    }
+    printf("stress: passed\n");
+    return 0;
+}
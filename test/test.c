@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <criterion/criterion.h>
 #include <criterion/logging.h>
 #include <criterion/redirect.h>
@@ -6,36 +7,49 @@
 #include <stdio.h>
 #include "my_secmalloc.private.h"
 #include "sys/mman.h"
+#include <sys/wait.h>
+#include <errno.h>
 
 // Mock extern variables
 extern struct chunk *metadata_pages;
 extern struct chunk *data_pages;
-extern struct chunk *free_list;
 extern FILE *execution_report;
 
 Test(secmalloc, initialize_metadata_success) {
-    initialize_metadata();
+    heap_bootstrap();
     
     cr_assert_neq(metadata_pages, NULL, "Metadata pages were not initialized.");
     cr_assert_eq(metadata_pages->size, PAGE_SIZE - CHUNK_SIZE, "Metadata page size is incorrect.");
     cr_assert_eq(metadata_pages->flags, FREE, "Metadata page flags are not set to FREE.");
     cr_assert_eq(metadata_pages->canary_start, CANARY_VALUE, "Metadata canary start value is incorrect.");
     cr_assert_eq(metadata_pages->canary_end, CANARY_VALUE, "Metadata canary end value is incorrect.");
-    cr_assert_eq(free_list, metadata_pages, "Metadata pages were not added to the free list.");
-    
-    munmap(metadata_pages, PAGE_SIZE);
+    cr_assert_eq(free_lists[MSM_HEAP_DEFAULT], metadata_pages, "Metadata pages were not added to the free list.");
 }
 
 Test(secmalloc, initialize_data_success) {
-    initialize_data();
+    heap_bootstrap();
     
     cr_assert_neq(data_pages, NULL, "Data pages were not initialized.");
     cr_assert_eq(data_pages->size, PAGE_SIZE - CHUNK_SIZE, "Data page size is incorrect.");
     cr_assert_eq(data_pages->flags, FREE, "Data page flags are not set to FREE.");
     cr_assert_eq(data_pages->canary_start, CANARY_VALUE, "Data canary start value is incorrect.");
     cr_assert_eq(data_pages->canary_end, CANARY_VALUE, "Data canary end value is incorrect.");
-    
-    munmap(data_pages, PAGE_SIZE);
+}
+
+// The first pages and the page map root come from one mapping, set up once
+Test(secmalloc, bootstrap_maps_one_region) {
+    heap_bootstrap();
+    struct chunk *first = metadata_pages;
+    heap_bootstrap();
+
+    cr_assert_eq(heap_ready, 1, "heap_ready not set by the bootstrap");
+    cr_assert_eq(metadata_pages, first, "A second bootstrap remapped the heap");
+    cr_assert_eq((char *)data_pages, (char *)metadata_pages + PAGE_SIZE, "Initial pages are not one region");
+    cr_assert_eq((char *)pagemap_root, (char *)metadata_pages + BOOTSTRAP_PAGES * PAGE_SIZE,
+                 "Page map root not mapped with the initial pages");
+    cr_assert_eq(free_lists[MSM_HEAP_DEFAULT]->next, data_pages, "Data page not on the free list");
+    cr_assert_eq(msm_mapped_bytes(), BOOTSTRAP_PAGES * PAGE_SIZE, "Bootstrap pages not accounted");
+    cr_assert_eq(heap_check_invariants(), 0, "Heap inconsistent after the bootstrap");
 }
 
 Test(my_alloc, malloc_zero_size) {
@@ -344,8 +358,44 @@ Test(secmalloc, realloc_very_large_size) {
     cr_assert_eq(metadata->canary_start, CANARY_VALUE, "Canary start value is corrupted after realloc");
     cr_assert_eq(metadata->canary_end, CANARY_VALUE, "Canary end value is corrupted after realloc");
 
+    cr_assert_eq(pagemap_lookup(new_ptr).kind, PAGE_LARGE, "10 MB block not served by its own mapping");
     my_free(new_ptr);
-    cr_assert_eq(metadata->flags, FREE, "Chunk is not marked as FREE after my_free following realloc");
+    cr_assert_eq(msm_malloc_usable_size(new_ptr), 0, "Large block still owned after my_free");
+}
+
+// Large blocks get their own mapping, grow in place or move with their data
+Test(large, realloc_keeps_contents) {
+    char *ptr = my_malloc(1024 * 1024);
+    cr_assert_not_null(ptr, "my_malloc returned NULL for a 1 MB allocation");
+    cr_assert_eq((uintptr_t)ptr % 16, 0, "Large block is not 16-byte aligned");
+    cr_assert_geq(msm_malloc_usable_size(ptr), 1024 * 1024, "Large block usable size too small");
+    memset(ptr, 0x5a, 1024 * 1024);
+
+    char *grown = my_realloc(ptr, 4 * 1024 * 1024);
+    cr_assert_not_null(grown, "my_realloc returned NULL for a 4 MB allocation");
+    for (size_t i = 0; i < 1024 * 1024; i += 4096) {
+        cr_assert_eq(grown[i], 0x5a, "Large realloc lost the contents at offset %zu", i);
+    }
+    cr_assert_eq(heap_check_invariants(), 0, "Heap inconsistent with a large block live");
+    my_free(grown);
+    cr_assert_eq(pagemap_lookup(grown).kind, PAGE_NONE, "Freed large block still in the page map");
+}
+
+// The invariant checker agrees with a heap mixing every allocator
+Test(check, mixed_heap_is_consistent) {
+    void *ptrs[64];
+    for (size_t i = 0; i < 64; ++i) {
+        ptrs[i] = my_malloc(1 + i * 97);
+    }
+    for (size_t i = 0; i < 64; i += 2) {
+        my_free(ptrs[i]);
+    }
+    cr_assert_eq(heap_check_invariants(), 0, "Heap inconsistent after mixed allocations");
+    for (size_t i = 1; i < 64; i += 2) {
+        my_free(ptrs[i]);
+    }
+    msm_purge();
+    cr_assert_eq(heap_check_invariants(), 0, "Heap inconsistent after a purge");
 }
 
 void test_realloc_larger_size_with_free_chunk() {
@@ -374,3 +424,660 @@ void test_realloc_larger_size_no_free_chunks() {
 
     my_free(new_ptr);
 }
+
+// Purge of fully free pages
+Test(secmalloc, purge_releases_free_pages) {
+    void *ptrs[4];
+    for (size_t i = 0; i < 4; ++i) {
+        ptrs[i] = my_malloc(4000);
+        cr_assert_not_null(ptrs[i], "my_malloc returned NULL for a 4000 byte allocation");
+    }
+    for (size_t i = 0; i < 4; ++i) {
+        my_free(ptrs[i]);
+    }
+    cr_assert_geq(msm_purge(), PAGE_SIZE, "msm_purge should release at least one fully free page");
+
+    void *ptr = my_malloc(4000);
+    cr_assert_not_null(ptr, "my_malloc should still work after a purge");
+    my_free(ptr);
+}
+
+static void *fork_worker(void *arg) {
+    volatile int *stop = arg;
+    while (!*stop) {
+        void *ptr = my_malloc(64);
+        my_free(ptr);
+    }
+    return NULL;
+}
+
+// Fork while another thread is allocating
+Test(secmalloc, fork_with_busy_thread) {
+    volatile int stop = 0;
+    pthread_t thread;
+    my_free(my_malloc(16));
+    msm_set_fork_purge(1);
+    cr_assert_eq(pthread_create(&thread, NULL, fork_worker, (void *)&stop), 0, "pthread_create failed");
+
+    for (int i = 0; i < 20; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            void *ptr = my_malloc(128);
+            my_free(ptr);
+            _exit(ptr == NULL);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        cr_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "child could not allocate after fork");
+    }
+    stop = 1;
+    pthread_join(thread, NULL);
+}
+
+// Bounded-latency pool: exhaustion is reported, never served by mmap
+Test(rt_pool, exhaustion_returns_enomem) {
+    struct msm_rt_pool *pool = msm_rt_pool_create(64 * 1024);
+    cr_assert_not_null(pool, "msm_rt_pool_create failed");
+    msm_rt_pin(pool);
+
+    void *ptrs[64];
+    size_t count = 0;
+    errno = 0;
+    while (count < 64 && (ptrs[count] = my_malloc(4096)) != NULL) {
+        memset(ptrs[count], 'r', 4096);
+        count++;
+    }
+    cr_assert_lt(count, 64, "a 64 KB pool should not serve 64 pages");
+    cr_assert_eq(errno, ENOMEM, "pool exhaustion should set ENOMEM");
+
+    for (size_t i = 0; i < count; ++i) {
+        my_free(ptrs[i]);
+    }
+    void *whole = my_malloc(60 * 1024);
+    cr_assert_not_null(whole, "freed blocks should merge back into one block");
+    my_free(whole);
+
+    msm_rt_pin(NULL);
+    msm_rt_pool_destroy(pool);
+}
+
+struct rt_fork_arg {
+    struct msm_rt_pool *pool;
+    volatile int stop;
+};
+
+static void *rt_fork_worker(void *arg) {
+    struct rt_fork_arg *fork_arg = arg;
+    msm_rt_pin(fork_arg->pool);
+    while (!fork_arg->stop) {
+        my_free(my_malloc(48));
+    }
+    msm_rt_pin(NULL);
+    return NULL;
+}
+
+// Bounded-latency pool: fork while another thread holds the pool lock
+Test(rt_pool, fork_with_busy_pool) {
+    struct rt_fork_arg arg = { msm_rt_pool_create(64 * 1024), 0 };
+    pthread_t thread;
+    cr_assert_not_null(arg.pool, "msm_rt_pool_create failed");
+    cr_assert_eq(pthread_create(&thread, NULL, rt_fork_worker, &arg), 0, "pthread_create failed");
+
+    for (int i = 0; i < 20; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            msm_rt_pin(arg.pool);
+            void *ptr = my_malloc(48);
+            my_free(ptr);
+            _exit(ptr == NULL);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        cr_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "child could not use the pool after fork");
+    }
+    arg.stop = 1;
+    pthread_join(thread, NULL);
+    msm_rt_pool_destroy(arg.pool);
+}
+
+// Bounded-latency pool: no mapping after creation, free blocks always found
+Test(rt_pool, bounded_operations) {
+    enum { OPS = 4096, SLOTS = 256 };
+    void *slots[SLOTS] = { NULL };
+    unsigned int seed = 42;
+    struct msm_rt_pool *pool = msm_rt_pool_create(4 * 1024 * 1024);
+    cr_assert_not_null(pool, "msm_rt_pool_create failed");
+    msm_rt_pin(pool);
+    size_t mapped = msm_mapped_bytes();
+
+    // At most SLOTS blocks of 8 KiB are live, far below the pool size, so
+    // every allocation must be served from the free lists without mapping.
+    for (int op = 0; op < OPS; ++op) {
+        int slot = rand_r(&seed) % SLOTS;
+        size_t size = 1 + (size_t)(rand_r(&seed) % 8192);
+        if (slots[slot] != NULL) {
+            my_free(slots[slot]);
+            slots[slot] = NULL;
+        } else {
+            slots[slot] = my_malloc(size);
+            cr_assert_not_null(slots[slot], "pool allocation %d of %zu bytes failed", op, size);
+        }
+    }
+    for (int slot = 0; slot < SLOTS; ++slot) {
+        my_free(slots[slot]);
+    }
+    cr_assert_eq(msm_mapped_bytes(), mapped, "the pool mapped memory after its creation");
+    void *whole = my_malloc(3 * 1024 * 1024);
+    cr_assert_not_null(whole, "freed blocks should merge back into one block");
+    my_free(whole);
+
+    msm_rt_pin(NULL);
+    msm_rt_pool_destroy(pool);
+}
+
+#if MSM_HISTOGRAMS
+// Latency histograms: every caller-visible call is counted once
+Test(histograms, records_operations) {
+    static struct msm_histograms hist;
+    cr_assert_eq(msm_histograms_enable(1), 0, "histograms should be compiled in");
+    for (int i = 0; i < 100; ++i) {
+        void *ptr = my_malloc(100);
+        ptr = my_realloc(ptr, 200);
+        my_free(ptr);
+    }
+    my_free(my_calloc(4, 8));
+    msm_histograms_enable(0);
+    my_free(my_malloc(100));
+
+    msm_histograms_collect(&hist);
+    uint64_t totals[MSM_OP_COUNT] = { 0 };
+    for (int op = 0; op < MSM_OP_COUNT; ++op) {
+        for (int path = 0; path < MSM_PATH_COUNT; ++path) {
+            for (int cls = 0; cls < MSM_HIST_SIZE_CLASSES; ++cls) {
+                for (int bucket = 0; bucket < MSM_HIST_BUCKETS; ++bucket) {
+                    totals[op] += hist.count[op][path][cls][bucket];
+                }
+            }
+        }
+    }
+    cr_assert_eq(totals[MSM_OP_MALLOC], 100, "expected 100 mallocs, got %llu", (unsigned long long)totals[MSM_OP_MALLOC]);
+    cr_assert_eq(totals[MSM_OP_REALLOC], 100, "nested calls must not be recorded separately");
+    cr_assert_eq(totals[MSM_OP_FREE], 101, "expected 101 frees");
+    cr_assert_eq(totals[MSM_OP_CALLOC], 1, "expected 1 calloc");
+}
+#endif
+
+// Hard limit on mapped bytes
+Test(limits, hard_limit_returns_enomem) {
+    my_free(my_malloc(16));
+    size_t base = msm_mapped_bytes();
+    cr_assert_eq(msm_set_limits(0, base + 3 * PAGE_SIZE), 0, "msm_set_limits failed");
+
+    void *ptrs[16];
+    size_t count = 0;
+    errno = 0;
+    while (count < 16 && (ptrs[count] = my_malloc(4000)) != NULL) {
+        count++;
+    }
+    cr_assert_lt(count, 16, "the hard limit was not enforced");
+    cr_assert_eq(errno, ENOMEM, "hitting the hard limit should set ENOMEM");
+    cr_assert_leq(msm_mapped_bytes(), base + 3 * PAGE_SIZE, "mapped bytes went over the hard limit");
+
+    for (size_t i = 0; i < count; ++i) {
+        my_free(ptrs[i]);
+    }
+    msm_set_limits(0, 0);
+}
+
+static void count_pressure(size_t mapped, void *arg) {
+    (void)mapped;
+    ++*(int *)arg;
+}
+
+// Soft limit: purge and notify
+Test(limits, soft_limit_purges_and_notifies) {
+    int calls = 0;
+    void *ptrs[8];
+    for (size_t i = 0; i < 8; ++i) {
+        ptrs[i] = my_malloc(4000);
+    }
+    for (size_t i = 0; i < 8; ++i) {
+        my_free(ptrs[i]);
+    }
+    size_t before = msm_mapped_bytes();
+    msm_set_soft_limit_callback(count_pressure, &calls);
+    msm_set_limits(before / 2, 0);
+
+    void *ptr = my_malloc(8000);
+    cr_assert_not_null(ptr, "the soft limit must not fail allocations");
+    cr_assert_eq(calls, 1, "the callback should run once per crossing");
+    cr_assert_lt(msm_mapped_bytes(), before, "free pages should have been purged");
+    my_free(ptr);
+    msm_set_limits(0, 0);
+    msm_set_soft_limit_callback(NULL, NULL);
+}
+
+struct delta_arg {
+    void *block;
+    volatile int ready;
+    volatile int stop;
+};
+
+static void *delta_worker(void *arg) {
+    struct delta_arg *delta_arg = arg;
+    delta_arg->block = my_malloc(64 * 1024);
+    delta_arg->ready = 1;
+    while (!delta_arg->stop) {
+        sched_yield();
+    }
+    return NULL;
+}
+
+// Unfolded deltas of other threads are not lost across fork
+Test(limits, fork_folds_thread_deltas) {
+    struct delta_arg arg = { NULL, 0, 0 };
+    pthread_t thread;
+    my_free(my_malloc(16));
+    size_t base = msm_mapped_bytes();
+    cr_assert_eq(pthread_create(&thread, NULL, delta_worker, &arg), 0, "pthread_create failed");
+    while (!arg.ready) {
+        sched_yield();
+    }
+    cr_assert_not_null(arg.block, "my_malloc failed in the worker");
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The worker's mapping is only in its own delta: the child must
+        // still count it.
+        _exit(msm_mapped_bytes() != base + CHUNK_SIZE + msm_malloc_usable_size(arg.block));
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    cr_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "the child lost the worker's mapped bytes");
+    arg.stop = 1;
+    pthread_join(thread, NULL);
+    my_free(arg.block);
+}
+
+// Non-temporal kernels: unaligned heads and tails are handled
+Test(memops, kernels_match_libc) {
+    size_t size = 3 * 4096 + 77;
+    char *src = mmap(NULL, size + 64, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char *dst = mmap(NULL, size + 64, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    cr_assert_neq(src, MAP_FAILED, "mmap failed");
+    cr_assert_neq(dst, MAP_FAILED, "mmap failed");
+    for (size_t i = 0; i < size + 64; ++i) {
+        src[i] = (char)(i * 7);
+    }
+    for (size_t offset = 0; offset < 64; offset += 9) {
+        memset(dst, 'x', size + 64);
+        memops_copy_nt(dst + offset, src + 3, size - offset);
+        cr_assert_eq(memcmp(dst + offset, src + 3, size - offset), 0, "copy kernel corrupted data at offset %zu", offset);
+        cr_assert_eq(dst[offset + size - offset], 'x', "copy kernel wrote past the end");
+        memops_zero_nt(dst + offset, size - offset);
+        for (size_t i = offset; i < size; ++i) {
+            cr_assert_eq(dst[i], 0, "zero kernel missed byte %zu", i);
+        }
+        cr_assert_eq(dst[size], 'x', "zero kernel wrote past the end");
+    }
+    memset(dst, 'x', 64);
+    memops_zero_nt(dst + 1, 5);
+    cr_assert(dst[0] == 'x' && dst[1] == 0 && dst[5] == 0 && dst[6] == 'x', "zero kernel mishandled a buffer shorter than its alignment");
+    munmap(src, size + 64);
+    munmap(dst, size + 64);
+}
+
+// Small requests share one slab page; with random slots their order is shuffled
+Test(slab, slots_stay_in_one_page) {
+    char *ptrs[16];
+    int ascending = 1;
+    for (int i = 0; i < 16; ++i) {
+        ptrs[i] = my_malloc(64);
+        cr_assert_neq(ptrs[i], NULL, "Slab allocation %d failed", i);
+        cr_assert_eq(pagemap_lookup(ptrs[i]).kind, PAGE_SLAB, "Small allocation not served by a slab");
+        cr_assert_eq((uintptr_t)ptrs[i] / PAGE_SIZE, (uintptr_t)ptrs[0] / PAGE_SIZE, "Slots of one class spread over several pages");
+        cr_assert_eq(((struct chunk *)ptrs[i] - 1)->canary_start, CANARY_VALUE, "Slot header not initialized");
+        memset(ptrs[i], i, 64);
+        if (i > 0 && ptrs[i] < ptrs[i - 1]) {
+            ascending = 0;
+        }
+    }
+#if MSM_RANDOM_SLOTS
+    cr_assert_eq(ascending, 0, "Slots were handed out in address order");
+#else
+    cr_assert_eq(ascending, 1, "Slots were not handed out in address order");
+#endif
+    for (int i = 0; i < 16; ++i) {
+        cr_assert_eq(ptrs[i][63], (char)i, "Slot %d overwritten by a neighbour", i);
+        my_free(ptrs[i]);
+    }
+}
+
+// Double frees and interior pointers are caught by the slot bitmap
+Test(slab, double_free_is_ignored) {
+    char *a = my_malloc(100);
+    cr_assert_eq(pagemap_lookup(a).kind, PAGE_SLAB, "Small allocation not served by a slab");
+    my_free(a);
+    my_free(a);
+    my_free(a + 8);
+    char *b = my_malloc(100);
+    char *c = my_malloc(100);
+    cr_assert_neq(b, c, "A double-freed slot was handed out twice");
+    my_free(b);
+    my_free(c);
+}
+
+// The page map attributes every pointer to its allocator, and nothing else
+Test(pagemap, foreign_pointers_are_rejected) {
+    char *small = my_malloc(40);
+    char *large = my_malloc(1000);
+    struct msm_rt_pool *pool = msm_rt_pool_create(4096);
+    cr_assert_neq(pool, NULL, "Pool creation failed");
+    msm_rt_pin(pool);
+    char *pooled = my_malloc(100);
+    msm_rt_pin(NULL);
+
+    cr_assert_eq(msm_malloc_usable_size(small), 48, "Slab slot size not taken from the page map");
+    cr_assert_geq(msm_malloc_usable_size(large), 1000, "Chunk usable size too small");
+    cr_assert_geq(msm_malloc_usable_size(pooled), 100, "Pool block usable size too small");
+    cr_assert_eq(pagemap_lookup(pooled).kind, PAGE_RT_POOL, "Pool pages not in the page map");
+
+    char stack_buffer[64];
+    char *foreign = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    memset(foreign, 0x41, PAGE_SIZE);
+    cr_assert_eq(msm_malloc_usable_size(stack_buffer), 0, "Stack pointer reported as owned");
+    cr_assert_eq(msm_malloc_usable_size(foreign + 64), 0, "Foreign mapping reported as owned");
+    my_free(stack_buffer + 16);
+    my_free(foreign + 64);
+    cr_assert_eq(my_realloc(foreign + 64, 10), NULL, "Foreign pointer reallocated");
+    cr_assert_eq(foreign[0], 0x41, "Foreign memory written by free");
+
+    my_free(pooled);
+    msm_rt_pool_destroy(pool);
+    cr_assert_eq(pagemap_lookup(pooled).kind, PAGE_NONE, "Destroyed pool still in the page map");
+    my_free(small);
+    my_free(large);
+    munmap(foreign, PAGE_SIZE);
+}
+
+// Hinted blocks live in pages of their own heap, which empty out on their own
+Test(heaps, hints_segregate_lifetimes) {
+    void *short_lived[32];
+    void *long_lived[32];
+    for (size_t i = 0; i < 32; ++i) {
+        short_lived[i] = msm_malloc_hint(200, MSM_SHORT_LIVED);
+        long_lived[i] = msm_malloc_hint(200, MSM_LONG_LIVED);
+        cr_assert_not_null(short_lived[i], "msm_malloc_hint returned NULL");
+        cr_assert_not_null(long_lived[i], "msm_malloc_hint returned NULL");
+        cr_assert_eq(pagemap_lookup(short_lived[i]).owner, MSM_HEAP_SHORT_LIVED, "Short-lived block in the wrong heap");
+        cr_assert_eq(pagemap_lookup(long_lived[i]).owner, MSM_HEAP_LONG_LIVED, "Long-lived block in the wrong heap");
+    }
+    void *hot = msm_malloc_hint(64, MSM_HOT | MSM_LONG_LIVED);
+    cr_assert_eq(pagemap_lookup(hot).owner, MSM_HEAP_HOT, "MSM_HOT does not win over the lifetime");
+    void *moved = my_realloc(long_lived[0], 1000);
+    cr_assert_eq(pagemap_lookup(moved).owner, MSM_HEAP_LONG_LIVED, "my_realloc moved a block out of its heap");
+    long_lived[0] = moved;
+
+    for (size_t i = 0; i < 32; ++i) {
+        my_free(short_lived[i]);
+    }
+    struct msm_heap_stats stats[MSM_HEAP_COUNT];
+    cr_assert_eq(msm_heap_stats(stats), MSM_HEAP_COUNT, "msm_heap_stats did not fill every heap");
+    cr_assert_gt(stats[MSM_HEAP_SHORT_LIVED].pages, 0, "Short-lived heap has no pages");
+    cr_assert_eq(stats[MSM_HEAP_SHORT_LIVED].empty_pages, stats[MSM_HEAP_SHORT_LIVED].pages,
+                 "Short-lived pages pinned by other blocks");
+    cr_assert_eq(stats[MSM_HEAP_SHORT_LIVED].busy_bytes, 0, "Freed blocks still counted as busy");
+    cr_assert_eq(stats[MSM_HEAP_LONG_LIVED].empty_pages, 0, "Long-lived pages reported empty");
+    cr_assert_geq(stats[MSM_HEAP_LONG_LIVED].busy_bytes, 31 * 200 + 1000, "Long-lived busy bytes too small");
+    cr_assert_eq(heap_check_invariants(), 0, "Heap inconsistent with hinted blocks");
+
+    msm_purge();
+    msm_heap_stats(stats);
+    cr_assert_eq(stats[MSM_HEAP_SHORT_LIVED].pages, 0, "Empty short-lived pages not purged");
+    cr_assert_gt(stats[MSM_HEAP_SHORT_LIVED].pages_purged, 0, "Purged pages not counted");
+    for (size_t i = 0; i < 32; ++i) {
+        my_free(long_lived[i]);
+    }
+    my_free(hot);
+}
+
+// Aligned blocks of every size class are aligned, usable and freed with their size
+Test(aligned, alignments_and_sizes) {
+    size_t alignments[] = { 16, 32, 64, 256, 4096, 8192 };
+    size_t sizes[] = { 1, 24, 100, 1000, 3000, LARGE_THRESHOLD + 1, 3 * LARGE_THRESHOLD };
+
+    for (size_t a = 0; a < sizeof(alignments) / sizeof(alignments[0]); ++a) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            unsigned char *ptr = my_aligned_alloc(alignments[a], sizes[s]);
+            cr_assert_not_null(ptr, "my_aligned_alloc(%zu, %zu) returned NULL", alignments[a], sizes[s]);
+            cr_assert_eq((uintptr_t)ptr % alignments[a], 0, "Block %p not aligned on %zu", (void *)ptr, alignments[a]);
+            cr_assert_geq(msm_malloc_usable_size(ptr), sizes[s], "Usable size smaller than the request");
+            memset(ptr, 0xa5, sizes[s]);
+            cr_assert_eq(heap_check_invariants(), 0, "Heap inconsistent after my_aligned_alloc(%zu, %zu)",
+                         alignments[a], sizes[s]);
+            msm_free_sized(ptr, sizes[s]);
+        }
+    }
+    void *hinted = msm_aligned_alloc(128, 200, MSM_SHORT_LIVED);
+    cr_assert_eq((uintptr_t)hinted % 128, 0, "Hinted block not aligned");
+    cr_assert_eq(pagemap_lookup(hinted).owner, MSM_HEAP_SHORT_LIVED, "Aligned block in the wrong heap");
+    my_free(hinted);
+
+    errno = 0;
+    cr_assert_null(my_aligned_alloc(48, 64), "Alignment not a power of two accepted");
+    cr_assert_eq(errno, EINVAL, "Bad alignment did not set EINVAL");
+    cr_assert_eq(heap_check_invariants(), 0, "Heap inconsistent after aligned frees");
+}
+
+// A gap of 16 bytes before a 32-byte boundary still leaves a usable leading free chunk
+Test(aligned, small_alignment_leading_chunk) {
+    void *blocks[64];
+
+    // Each 32-byte block ends its header 16 bytes past a 32-byte boundary for the next one.
+    for (int i = 0; i < 64; ++i) {
+        blocks[i] = my_aligned_alloc(32, 32);
+        cr_assert_not_null(blocks[i], "my_aligned_alloc(32, 32) returned NULL");
+        cr_assert_eq((uintptr_t)blocks[i] % 32, 0, "Block %p not aligned on 32", blocks[i]);
+    }
+    cr_assert_eq(heap_check_invariants(), 0, "Heap inconsistent after 32-byte aligned allocations");
+    for (int i = 0; i < 64; ++i) {
+        my_free(blocks[i]);
+    }
+    cr_assert_eq(heap_check_invariants(), 0, "Heap inconsistent after freeing the aligned blocks");
+}
+
+#if MSM_CHECKS
+// A sized free claiming more than the block holds is refused
+Test(aligned, sized_free_checks_the_size) {
+    void *ptr = my_malloc(100);
+    msm_free_sized(ptr, 100000);
+    cr_assert_geq(msm_malloc_usable_size(ptr), 100, "Block freed despite a wrong size");
+    msm_free_sized(ptr, 100);
+    cr_assert_eq(heap_check_invariants(), 0, "Heap inconsistent after sized frees");
+}
+#endif
+
+#if MSM_SCRUBBER
+// A corrupted header of a block that is never freed is found by a scrubbing pass
+Test(scrubber, finds_corrupted_busy_chunk) {
+    char *block = my_malloc(1000);
+    struct chunk *chunk = (struct chunk *)block - 1;
+    struct msm_scrub_stats before, after;
+
+    msm_scrubber_stats(&before);
+    cr_assert_eq(msm_scrub(1000000), 0, "Scrubber reported a consistent heap as corrupted");
+    chunk->canary_end ^= 1;
+    // The pass in progress may already be past the block: finish it, then run a whole one.
+    do {
+        msm_scrub(1000000);
+        msm_scrubber_stats(&after);
+    } while (after.passes < before.passes + 3);
+    chunk->canary_end ^= 1;
+    cr_assert_gt(after.errors, before.errors, "Corrupted canary not found");
+    cr_assert_eq(after.last_error, chunk, "Corruption reported at %p instead of %p", after.last_error, (void *)chunk);
+    cr_assert_gt(after.pages, before.pages, "No page checked");
+    my_free(block);
+}
+
+// The background thread finds a corrupted slab slot on its own
+Test(scrubber, background_thread_reports) {
+    char *slot = my_malloc(40);
+    struct chunk *chunk = (struct chunk *)slot - 1;
+    struct msm_scrub_stats stats;
+
+    cr_assert_eq(pagemap_lookup(slot).kind, PAGE_SLAB, "Small block not in a slab");
+    cr_assert_eq(msm_scrubber_start(1, 1000), 0, "msm_scrubber_start failed");
+    errno = 0;
+    cr_assert_eq(msm_scrubber_start(1, 1000), -1, "Second scrubber started");
+    cr_assert_eq(errno, EBUSY, "Second start did not set EBUSY");
+    chunk->canary_start ^= 1;
+    for (int i = 0; i < 2000; ++i) {
+        msm_scrubber_stats(&stats);
+        if (stats.last_error == chunk) {
+            break;
+        }
+        usleep(1000);
+    }
+    msm_scrubber_stop();
+    chunk->canary_start ^= 1;
+    cr_assert_eq(stats.last_error, chunk, "Background scrubber did not report the slot");
+    my_free(slot);
+    cr_assert_eq(heap_check_invariants(), 0, "Heap inconsistent after scrubbing");
+}
+#endif
+
+// A message allocated by one process is read and freed by another, and survives a re-attach
+Test(shm_heap, cross_process_message) {
+    int fd = memfd_create("msm_test", 0);
+    cr_assert_geq(fd, 0, "memfd_create failed");
+    struct msm_shm_heap *heap = msm_shm_create(fd, 64 * PAGE_SIZE);
+    cr_assert_neq(heap, NULL, "Heap creation failed");
+    int channel[2];
+    cr_assert_eq(pipe(channel), 0, "pipe failed");
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        struct msm_shm_heap *child = msm_shm_attach(fd);
+        char *message = child != NULL ? msm_shm_malloc(child, 100000) : NULL;
+        if (message == NULL) {
+            _exit(1);
+        }
+        memset(message, 'm', 100000);
+        uint64_t offset = msm_shm_offset(child, message);
+        write(channel[1], &offset, sizeof(offset));
+        _exit(0);
+    }
+    uint64_t offset = 0;
+    cr_assert_eq(read(channel[0], &offset, sizeof(offset)), sizeof(offset), "No offset received");
+    int status = 0;
+    waitpid(pid, &status, 0);
+    cr_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "Child failed to allocate");
+
+    msm_shm_detach(heap);
+    heap = msm_shm_attach(fd);
+    cr_assert_neq(heap, NULL, "Re-attach failed");
+    char *message = msm_shm_pointer(heap, offset);
+    cr_assert_neq(message, NULL, "Offset rejected");
+    cr_assert(message[0] == 'm' && message[99999] == 'm', "Message lost across processes");
+    msm_shm_free(heap, message);
+    char *whole = msm_shm_malloc(heap, 60 * PAGE_SIZE);
+    cr_assert_neq(whole, NULL, "Freed message not merged back");
+    msm_shm_free(heap, whole);
+    msm_shm_free(heap, whole);
+    msm_shm_detach(heap);
+    close(channel[0]);
+    close(channel[1]);
+    close(fd);
+}
+
+// A process dying with the heap lock held does not wedge the others
+Test(shm_heap, robust_lock_recovery) {
+    int fd = memfd_create("msm_test", 0);
+    struct msm_shm_heap *heap = msm_shm_create(fd, 16 * PAGE_SIZE);
+    cr_assert_neq(heap, NULL, "Heap creation failed");
+    void *kept = msm_shm_malloc(heap, 1000);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        pthread_mutex_lock(&heap->lock);
+        heap->free_list = 0;
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    void *ptr = msm_shm_malloc(heap, 2000);
+    cr_assert_neq(ptr, NULL, "Heap unusable after its lock holder died");
+    cr_assert_neq(ptr, kept, "Recovery handed out a busy chunk");
+    msm_shm_free(heap, ptr);
+    msm_shm_free(heap, kept);
+    msm_shm_detach(heap);
+    close(fd);
+}
+
+// Pointers stored in a persistent heap survive a crash and a reopen
+Test(persist, reopen_after_crash) {
+    char path[] = "/tmp/msm_persist_XXXXXX";
+    int tmp = mkstemp(path);
+    cr_assert_geq(tmp, 0, "mkstemp failed");
+    close(tmp);
+    struct node { struct node *next; int value; };
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        struct msm_shm_heap *heap = msm_persist_open(path, 64 * PAGE_SIZE, NULL);
+        struct node *head = NULL;
+        for (int i = 0; heap != NULL && i < 3; ++i) {
+            struct node *node = msm_shm_malloc(heap, sizeof(*node));
+            node->value = i;
+            node->next = head;
+            head = node;
+        }
+        if (heap == NULL || msm_shm_set_root(heap, "list", head) != 0) {
+            _exit(1);
+        }
+        msm_persist_sync(heap);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    cr_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "Child failed to build the heap");
+
+    struct msm_shm_heap *heap = msm_persist_open(path, 0, NULL);
+    cr_assert_neq(heap, NULL, "Reopen failed");
+    cr_assert_eq(heap->recoveries, 1, "Unclean close not recovered");
+    struct node *node = msm_shm_get_root(heap, "list");
+    for (int i = 2; i >= 0; --i) {
+        cr_assert_neq(node, NULL, "List cut short");
+        cr_assert_eq(node->value, i, "Node value lost");
+        node = node->next;
+    }
+    cr_assert_eq(msm_shm_get_root(heap, "missing"), NULL, "Unknown root found");
+    msm_persist_close(heap);
+
+    heap = msm_persist_open(path, 0, NULL);
+    cr_assert_neq(heap, NULL, "Second reopen failed");
+    cr_assert_eq(heap->recoveries, 1, "Clean close still recovered");
+    msm_persist_close(heap);
+    unlink(path);
+}
+
+// A new heap whose address range is taken leaves its file empty
+Test(persist, busy_base_leaves_file_empty) {
+    char path[] = "/tmp/msm_persist_XXXXXX";
+    void *base = (void *)0x610000000000UL;
+    int tmp = mkstemp(path);
+    cr_assert_geq(tmp, 0, "mkstemp failed");
+    void *blocker = mmap(base, PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    cr_assert_eq(blocker, base, "Could not map the blocker");
+
+    errno = 0;
+    cr_assert_eq(msm_persist_open(path, 64 * PAGE_SIZE, base), NULL, "Heap opened over a busy range");
+    cr_assert_eq(errno, EEXIST, "Busy range should set EEXIST");
+    cr_assert_eq(lseek(tmp, 0, SEEK_END), 0, "The failed open left a sized file");
+
+    munmap(blocker, PAGE_SIZE);
+    struct msm_shm_heap *heap = msm_persist_open(path, 64 * PAGE_SIZE, base);
+    cr_assert_eq((void *)heap, base, "The file could not be opened as new afterwards");
+    msm_persist_close(heap);
+    close(tmp);
+    unlink(path);
+}